@@ -85,6 +85,8 @@ public:
     Triangle getTriangleFromFaceIndex(size_t i) const { return getTriangleFromFace(faces.at(i)); }
 
     const BVH& getBVH() const { return bvh; }
+    /// re-build the BVH, e.g. to use a different split method
+    void buildBVH(const BVH::BuildParameters& params = {}) { bvh.construct(*this, params); }
 
 private:
     /// the vertices of the mesh
@@ -13,9 +13,12 @@ struct Intersection {
 };
 
 bool intersect(const AABB& aabb, const IntersectionRay& ray);
+/// test a box and compute the distance at which the ray enters it
+bool intersect(const AABB& aabb, const IntersectionRay& ray, float& tNear);
 Intersection intersect(const Triangle& triangle, const IntersectionRay& ray);
 Intersection intersect(const Mesh& mesh, const IntersectionRay& ray);
 Intersection intersect(const Scene& scene, const IntersectionRay& ray);
-Intersection intersect(const Mesh& mesh, const IntersectionRay& ray, const std::vector<BVH::Node>& nodes, size_t currentIdx);
+/// traverse the BVH of the mesh nearer child first and skip subtrees behind the closest hit
+Intersection intersect(const Mesh& mesh, const IntersectionRay& ray, const BVH& bvh);
 
 #endif // !INTERSECTION_H
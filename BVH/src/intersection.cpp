@@ -4,12 +4,20 @@
 #include "ray.h"
 #include "scene.h"
 
+#include <array>
+
 bool intersect(const AABB& aabb, const IntersectionRay& ray)
+{
+    float tNear;
+    return intersect(aabb, ray, tNear);
+}
+
+bool intersect(const AABB& aabb, const IntersectionRay& ray, float& tNear)
 {
     const Point3D t1 = (aabb.min - ray.origin) * ray.inv_direction;
     const Point3D t2 = (aabb.max - ray.origin) * ray.inv_direction;
 
-    const float tNear = ::min(t1, t2).maxComponent();
+    tNear = ::min(t1, t2).maxComponent();
     const float tFar = ::max(t1, t2).minComponent();
 
     return tNear <= tFar && tNear <= ray.t_max && tFar >= ray.t_min;
@@ -66,7 +74,7 @@ Intersection intersect(const Mesh& mesh, const IntersectionRay& ray)
 
     if (intersect(mesh.getBounds(), ray)) {
         if (mesh.getBVH().isConstructed())  {
-            result = intersect(mesh, ray, mesh.getBVH().getNodes(), 0);
+            result = intersect(mesh, ray, mesh.getBVH());
         }
         else {
 //             brute-force intersection test
@@ -83,30 +91,72 @@ Intersection intersect(const Mesh& mesh, const IntersectionRay& ray)
 }
 
 
-Intersection intersect(const Mesh& mesh, const IntersectionRay& ray, const std::vector<BVH::Node>& nodes, size_t currentIdx)
+Intersection intersect(const Mesh& mesh, const IntersectionRay& ray, const BVH& bvh)
 {
     Intersection result;
-
-    if (!intersect(nodes[currentIdx].bounds, ray))
+    const std::vector<BVH::Node>& nodes = bvh.getNodes();
+
+    // shorten the ray to the closest hit so far, so that subtrees behind it are skipped
+    IntersectionRay closestHitRay{ray};
+
+    struct StackEntry {
+        size_t nodeIdx;
+        /// distance at which the ray enters the node
+        float tNear;
+    };
+    // at most one child is deferred per level of the tree
+    std::array<StackEntry, BVH::maxDepth + 1> stack;
+    size_t stackSize = 0;
+
+    float rootTNear;
+    if (!intersect(nodes[0].bounds, closestHitRay, rootTNear))
         return result;
+    stack[stackSize++] = {0, rootTNear};
+
+    while (stackSize > 0) {
+        const StackEntry entry = stack[--stackSize];
+        // a closer hit may have been found since the node was pushed
+        if (entry.tNear > closestHitRay.t_max)
+            continue;
+
+        // the children of a leaf are empty or outside of the tree
+        const size_t leftIdx = entry.nodeIdx * 2 + 1;
+        const size_t rightIdx = leftIdx + 1;
+        if (leftIdx >= nodes.size() || nodes[leftIdx].facesEnd == 0) {
+            for (const uint32_t faceIdx : bvh.getFaceIndices(nodes[entry.nodeIdx])) {
+                const Triangle triangle = mesh.getTriangleFromFaceIndex(faceIdx);
+                const Intersection its = intersect(triangle, closestHitRay);
+                if (its.t < result.t) {
+                    result = its;
+                    closestHitRay.t_max = its.t;
+                }
+            }
+            continue;
+        }
 
-    if (mesh.getBVH().isNodeLeaf(currentIdx)) {
-        std::span<const uint32_t> faceIndices = mesh.getBVH().getFaceIndices(nodes[currentIdx]);
-        for (const uint32_t faceIdx: faceIndices) {
-            const Triangle triangle = mesh.getTriangleFromFaceIndex(faceIdx);
-            const Intersection its = intersect(triangle, ray);
-            if (its.t < result.t)
-                result = its;
+        float leftTNear, rightTNear;
+        const bool hitLeft = intersect(nodes[leftIdx].bounds, closestHitRay, leftTNear);
+        const bool hitRight =
+            rightIdx < nodes.size() && intersect(nodes[rightIdx].bounds, closestHitRay, rightTNear);
+
+        // push the farther child first, so the nearer one is visited next
+        if (hitLeft && hitRight) {
+            if (leftTNear < rightTNear) {
+                stack[stackSize++] = {rightIdx, rightTNear};
+                stack[stackSize++] = {leftIdx, leftTNear};
+            }
+            else {
+                stack[stackSize++] = {leftIdx, leftTNear};
+                stack[stackSize++] = {rightIdx, rightTNear};
+            }
+        }
+        else if (hitLeft) {
+            stack[stackSize++] = {leftIdx, leftTNear};
+        }
+        else if (hitRight) {
+            stack[stackSize++] = {rightIdx, rightTNear};
         }
-        return result;
     }
 
-    Intersection leftResult = intersect(mesh, ray, nodes, currentIdx * 2 + 1);
-    Intersection rightResult;
-    if (currentIdx * 2 + 2 < nodes.size())
-        rightResult = intersect(mesh, ray, nodes, currentIdx * 2 + 2);
-
-    if (leftResult.t < rightResult.t && leftResult.t < result.t)
-        return leftResult;
-    return rightResult;
+    return result;
 }
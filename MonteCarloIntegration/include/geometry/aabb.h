@@ -26,6 +26,15 @@ struct AABB {
     /// returns the center of the bounding box
     Point3D center() const { return (min + max) * 0.5f; }
 
+    /// returns the surface area of the bounding box (zero if it is empty)
+    float surfaceArea() const
+    {
+        if (!(min <= max))
+            return 0.0f;
+        const Vector3D e = extents();
+        return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+
     /// checks whether the point is contained in the bounding box
     bool contains(const Point3D& p) const { return p >= min && p <= max; }
 
@@ -20,6 +20,21 @@ public:
     static constexpr uint32_t maxDepth{20};
     static_assert(maxDepth >= 1 && maxDepth <= 32, "maxDepth needs to be between 1 and 32");
 
+    /// strategy used to partition the faces of an inner node
+    enum class SplitMethod { Median, SAH };
+
+    struct BuildParameters {
+        SplitMethod splitMethod{SplitMethod::Median};
+        /// number of bins per axis used to evaluate the surface area heuristic
+        uint32_t numBins{16};
+        /// largest leaf the SAH builder may create if splitting would be more expensive
+        uint32_t maxFacesPerLeaf{8};
+        /// estimated cost of visiting an inner node (relative to one triangle test)
+        float traversalCost{1.0f};
+        /// estimated cost of intersecting a ray with one triangle
+        float intersectionCost{1.0f};
+    };
+
     struct Node {
         /// bounding box of all contained triangles
         AABB bounds;
@@ -32,7 +47,9 @@ public:
     BVH() = default;
 
     /// construct a BVH for the given mesh (implemented in exercise03.cpp)
-    void construct(const Mesh& mesh);
+    void construct(const Mesh& mesh, const BuildParameters& params);
+    /// construct a BVH for the given mesh using the default parameters
+    void construct(const Mesh& mesh) { construct(mesh, {}); }
 
     bool isConstructed() const { return !nodes.empty(); }
 
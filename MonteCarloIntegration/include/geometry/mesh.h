@@ -143,6 +143,8 @@ public:
     }
 
     const BVH& getBVH() const { return bvh; }
+    /// re-build the BVH, e.g. to use a different split method
+    void buildBVH(const BVH::BuildParameters& params = {}) { bvh.construct(*this, params); }
 
 private:
     /// the vertices of the mesh
@@ -5,10 +5,106 @@
 
 #include <algorithm>
 #include <bit>
+#include <cmath>
 #include <iostream>
 #include <limits>
+#include <span>
 
-void BVH::construct(const Mesh& mesh)
+namespace {
+/// a bin of the binned surface area heuristic
+struct SAHBin {
+    AABB bounds;
+    uint32_t numFaces{0};
+};
+
+/// the cheapest split found by the binned surface area heuristic
+struct SAHSplit {
+    /// split dimension
+    uint8_t dim{0};
+    /// faces in bins [0, bin) go to the left child, all others to the right child
+    uint32_t bin{0};
+    /// estimated cost of the split (infinity if no valid split exists)
+    float cost{infinity};
+    /// offset and scale mapping a centroid coordinate to its bin
+    float binOffset{0.0f};
+    float binScale{0.0f};
+
+    uint32_t binIndex(const Point3D& centroid, uint32_t numBins) const
+    {
+        const float bin = (centroid[dim] - binOffset) * binScale;
+        return std::min(numBins - 1, static_cast<uint32_t>(std::max(bin, 0.0f)));
+    }
+};
+
+SAHSplit findSAHSplit(std::span<const uint32_t> faces, const AABB& nodeBounds,
+                      const std::vector<AABB>& faceBounds, const std::vector<Point3D>& centroids,
+                      const BVH::BuildParameters& params, std::vector<SAHBin>& bins,
+                      std::vector<AABB>& rightBounds)
+{
+    AABB centroidBounds;
+    for (uint32_t faceIndex : faces)
+        centroidBounds.extend(centroids[faceIndex]);
+
+    const float nodeArea = nodeBounds.surfaceArea();
+    const float invNodeArea = nodeArea > 0.0f ? 1.0f / nodeArea : 1.0f;
+    const uint32_t numBins = params.numBins;
+
+    SAHSplit best;
+    for (uint8_t dim = 0; dim < 3; ++dim) {
+        const float extent = centroidBounds.max[dim] - centroidBounds.min[dim];
+        // all centroids lie on a plane orthogonal to this dimension
+        if (!(extent > 0.0f))
+            continue;
+
+        SAHSplit split;
+        split.dim = dim;
+        split.binOffset = centroidBounds.min[dim];
+        split.binScale = static_cast<float>(numBins) / extent;
+
+        std::fill(bins.begin(), bins.end(), SAHBin{});
+        for (uint32_t faceIndex : faces) {
+            SAHBin& bin = bins[split.binIndex(centroids[faceIndex], numBins)];
+            bin.bounds += faceBounds[faceIndex];
+            ++bin.numFaces;
+        }
+
+        // sweep from the right to get the bounds of all possible right children
+        AABB accumulated;
+        for (uint32_t i = numBins - 1; i > 0; --i) {
+            accumulated += bins[i].bounds;
+            rightBounds[i] = accumulated;
+        }
+
+        // sweep from the left and evaluate the cost of splitting in front of bin i
+        accumulated = {};
+        uint32_t numLeft = 0;
+        for (uint32_t i = 1; i < numBins; ++i) {
+            accumulated += bins[i - 1].bounds;
+            numLeft += bins[i - 1].numFaces;
+            const uint32_t numRight = static_cast<uint32_t>(faces.size()) - numLeft;
+            if (!numLeft || !numRight)
+                continue;
+
+            const float cost = params.traversalCost
+                             + params.intersectionCost * invNodeArea
+                                   * (accumulated.surfaceArea() * static_cast<float>(numLeft)
+                                      + rightBounds[i].surfaceArea()
+                                            * static_cast<float>(numRight));
+            if (cost < split.cost) {
+                split.cost = cost;
+                split.bin = i;
+            }
+        }
+
+        if (split.cost < best.cost)
+            best = split;
+    }
+
+    return best;
+}
+} // namespace
+
+void BVH::construct(const Mesh& mesh, const BuildParameters& params)
 {
     *this = {}; // clear all previous data
 
@@ -21,13 +117,19 @@ void BVH::construct(const Mesh& mesh)
 
     std::cout << "Building a BVH for a mesh containing " << numFaces << " faces... " << std::flush;
 
+    const bool useSAH = params.splitMethod == SplitMethod::SAH && params.numBins >= 2;
+
     // estimate the number of BVH nodes and reserve space
+    uint32_t maxNodes;
     {
         uint32_t numNodes = std::bit_ceil(numFaces / numFacesPerLeaf);
         numNodes = std::min(numNodes, (1U << maxDepth)) - 1;
 
         nodes.reserve(numNodes);
         faceIndices.reserve(numFaces);
+
+        // the median split yields a balanced tree, SAH trees may use all levels up to maxDepth
+        maxNodes = useSAH ? (1U << maxDepth) - 1 : numNodes;
     }
 
     // initialize the BVH
@@ -41,20 +143,63 @@ void BVH::construct(const Mesh& mesh)
         return (triangle.v1[dim] + triangle.v2[dim] + triangle.v3[dim]) * (1.0f / 3.0f);
     };
 
-    for (uint32_t i = 0; i < nodes.size() && i < (nodes.capacity() - 1) / 2; ++i) {
+    // per-face bounds and centroids, only needed by the SAH builder
+    std::vector<AABB> faceBounds;
+    std::vector<Point3D> centroids;
+    std::vector<SAHBin> bins;
+    std::vector<AABB> rightBounds;
+    if (useSAH) {
+        faceBounds.resize(numFaces);
+        centroids.resize(numFaces);
+        for (uint32_t i = 0; i < numFaces; ++i) {
+            const Triangle triangle = mesh.getTriangleFromFaceIndex(i);
+            faceBounds[i].extend(triangle.v1);
+            faceBounds[i].extend(triangle.v2);
+            faceBounds[i].extend(triangle.v3);
+            centroids[i] = (triangle.v1 + triangle.v2 + triangle.v3) * (1.0f / 3.0f);
+        }
+        bins.resize(params.numBins);
+        rightBounds.resize(params.numBins);
+    }
+
+    for (uint32_t i = 0; i < nodes.size() && i < maxNodes / 2; ++i) {
         const Node& currentNode = nodes.at(i);
         if (getFaceIndices(currentNode).size() <= numFacesPerLeaf)
             continue;
 
-        const uint8_t splitDim = currentNode.bounds.extents().maxDimension();
         auto currentFaces = getFaceIndices(currentNode);
-
-        // median split
         auto center = currentFaces.begin() + currentFaces.size() / 2;
-        std::nth_element(currentFaces.begin(), center, currentFaces.end(),
-                         [&](uint32_t a, uint32_t b) -> bool {
-                             return triangleCenter(a, splitDim) < triangleCenter(b, splitDim);
-                         });
+        bool medianSplit = true;
+
+        if (useSAH) {
+            const SAHSplit split = findSAHSplit(currentFaces, currentNode.bounds, faceBounds,
+                                                centroids, params, bins, rightBounds);
+            const float leafCost =
+                params.intersectionCost * static_cast<float>(currentFaces.size());
+
+            // terminate early if intersecting all faces is cheaper than splitting
+            if (currentFaces.size() <= params.maxFacesPerLeaf && leafCost <= split.cost)
+                continue;
+
+            // fall back to the median split if all centroids fall into the same bin
+            if (std::isfinite(split.cost)) {
+                center = std::partition(currentFaces.begin(), currentFaces.end(),
+                                        [&](uint32_t faceIndex) -> bool {
+                                            return split.binIndex(centroids[faceIndex],
+                                                                  params.numBins)
+                                                 < split.bin;
+                                        });
+                medianSplit = false;
+            }
+        }
+
+        if (medianSplit) {
+            const uint8_t splitDim = currentNode.bounds.extents().maxDimension();
+            std::nth_element(currentFaces.begin(), center, currentFaces.end(),
+                             [&](uint32_t a, uint32_t b) -> bool {
+                                 return triangleCenter(a, splitDim) < triangleCenter(b, splitDim);
+                             });
+        }
 
         Node left;
         Node right;
@@ -4,13 +4,17 @@
 #include <render/ray.h>
 #include <render/scene.h>
 
+#include <limits>
+
 bool Intersection::intersect(const AABB& aabb, const IntersectionRay& ray)
 {
     const Point3D t1 = (aabb.min - ray.origin) * ray.inv_direction;
     const Point3D t2 = (aabb.max - ray.origin) * ray.inv_direction;
 
     const float tNear = ::min(t1, t2).maxComponent();
-    const float tFar = ::max(t1, t2).minComponent();
+    // enlarge the interval slightly to account for rounding errors (flat boxes are common)
+    const float tFar = ::max(t1, t2).minComponent()
+                     * (1.0f + 4.0f * std::numeric_limits<float>::epsilon());
 
     return tNear <= tFar && tNear <= ray.tMax && tFar >= ray.tMin;
 }
@@ -0,0 +1,45 @@
+#include "scene_generator.h"
+
+#include <geometry/mesh.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+
+namespace {
+template <typename Function> double bestOfSeconds(uint32_t rounds, Function function)
+{
+    using Clock = std::chrono::steady_clock;
+    double best = 1e30;
+    for (uint32_t round = 0; round < rounds; ++round) {
+        const auto start = Clock::now();
+        function();
+        best = std::min(best, std::chrono::duration<double>(Clock::now() - start).count());
+    }
+    return best;
+}
+} // namespace
+
+/// usage: obj_load_benchmark [quads per side] [rounds]
+/// (only uses the public mesh interface, so it also builds against older parsers for comparison)
+int main(int argc, char** argv)
+{
+    const uint32_t quadsPerSide = argc > 1 ? std::atoi(argv[1]) : 708;
+    const uint32_t rounds = argc > 2 ? std::atoi(argv[2]) : 3;
+
+    const std::string filename = scene_generator::writeQuadGrid("obj_load_benchmark.obj",
+                                                                quadsPerSide);
+    std::cout << std::fixed;
+    std::cout.precision(3);
+    std::cout << "file: " << 2 * quadsPerSide * quadsPerSide << " faces, "
+              << std::filesystem::file_size(filename) / (1024 * 1024) << " MB\n";
+
+    // loadOBJ also builds the BVH, its build time is measured separately and subtracted
+    Mesh mesh;
+    const double load = bestOfSeconds(rounds, [&] { mesh.loadOBJ(filename); });
+    const double build = bestOfSeconds(rounds, [&] { mesh.buildBVH(); });
+    std::cout << "load: " << load << " s, BVH build: " << build << " s, parsing: " << load - build
+              << " s" << std::endl;
+}
@@ -0,0 +1,115 @@
+#include "scene_generator.h"
+
+#include <render/camera.h>
+#include <render/intersection.h>
+#include <render/raytracer.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+namespace {
+/// side length of the square packets of camera rays (as traced by the ray tracer)
+constexpr uint32_t packetSize{4};
+constexpr uint32_t packetRays{packetSize * packetSize};
+
+template <typename Function> double measureSeconds(Function function)
+{
+    using Clock = std::chrono::steady_clock;
+    const auto start = Clock::now();
+    function();
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+} // namespace
+
+/// usage: packet_benchmark [number of triangles] [resolution]
+int main(int argc, char** argv)
+{
+    const uint32_t numTriangles = argc > 1 ? std::atoi(argv[1]) : 300000;
+    const uint32_t resolution = argc > 2 ? std::atoi(argv[2]) : 512;
+
+    Mesh mesh{scene_generator::writeTriangleSoup("packet_benchmark.obj", numTriangles)};
+    BVH::BuildParameters buildParameters;
+    buildParameters.splitMethod = BVH::SplitMethod::SAH;
+    mesh.buildBVH(buildParameters);
+
+    Scene scene;
+    scene.addInstance({mesh, {Material::Diffuse{Color{0.5f}}}});
+    scene.addInstance(
+        {mesh, {Material::Diffuse{Color{0.5f}}}, {Matrix3D::scale(0.3f), {1.5f, 0.2f, 0.5f}}});
+    scene.addPointLight({300.0f, {0.0f, 2.5f, 2.0f}});
+    scene.buildInstanceBVH();
+
+    CameraParameters cameraParameters;
+    cameraParameters.pos = {0.3f, 0.8f, 3.0f};
+    cameraParameters.target = {0.0f, 0.3f, 0.0f};
+    cameraParameters.resolution = {resolution, resolution};
+    const Camera camera{cameraParameters};
+
+    // camera rays ordered by packet
+    std::vector<Ray> rays;
+    for (uint32_t tileY = 0; tileY + packetSize <= resolution; tileY += packetSize)
+        for (uint32_t tileX = 0; tileX + packetSize <= resolution; tileX += packetSize)
+            for (uint32_t y = tileY; y < tileY + packetSize; ++y)
+                for (uint32_t x = tileX; x < tileX + packetSize; ++x)
+                    rays.push_back(camera.generateRay({(x + 0.5f) * 2.0f / resolution - 1.0f,
+                                                       (y + 0.5f) * 2.0f / resolution - 1.0f}));
+
+    std::vector<Intersection> singleHits(rays.size()), packetHits(rays.size());
+    auto traceSingle = [&] {
+        for (size_t i = 0; i < rays.size(); ++i)
+            singleHits[i] = Intersection{scene, rays[i]};
+    };
+    auto tracePackets = [&] {
+        for (size_t i = 0; i < rays.size(); i += packetRays)
+            Intersection::intersect(scene, {rays.data() + i, packetRays},
+                                    {packetHits.data() + i, packetRays});
+    };
+    // warm up the caches
+    traceSingle();
+    tracePackets();
+
+    std::cout << std::fixed;
+    std::cout.precision(3);
+    std::cout << "mode        single    packet\n";
+    std::cout << "first hit   " << measureSeconds(traceSingle) << " s  "
+              << measureSeconds(tracePackets) << " s\n";
+
+    uint32_t mismatches = 0;
+    for (size_t i = 0; i < rays.size(); ++i)
+        mismatches += singleHits[i].distance != packetHits[i].distance
+                   || singleHits[i].triangleIndex != packetHits[i].triangleIndex;
+
+    RayTracer rayTracer;
+    rayTracer.setScene(scene);
+    const std::pair<RayTracerParameters::RenderMode, const char*> modes[]{
+        {RayTracerParameters::RenderMode::Depth, "Depth     "},
+        {RayTracerParameters::RenderMode::Position, "Position  "},
+        {RayTracerParameters::RenderMode::Normal, "Normal    "},
+        {RayTracerParameters::RenderMode::Whitted, "Whitted   "},
+        {RayTracerParameters::RenderMode::Path, "Path      "}};
+    for (const auto& [mode, name] : modes) {
+        RayTracerParameters parameters;
+        parameters.mode = mode;
+        rayTracer.setParams(parameters, cameraParameters);
+
+        float sum = 0.0f;
+        const double single = measureSeconds([&] {
+            for (const Ray& ray : rays)
+                sum += rayTracer.integrate(ray, {rayTracer.getScene(), ray}).r;
+        });
+        const double packet = measureSeconds([&] {
+            for (size_t i = 0; i < rays.size(); i += packetRays) {
+                Intersection::intersect(rayTracer.getScene(), {rays.data() + i, packetRays},
+                                        {packetHits.data() + i, packetRays});
+                for (size_t k = i; k < i + packetRays; ++k)
+                    sum += rayTracer.integrate(rays[k], packetHits[k]).r;
+            }
+        });
+        // (printing the sum keeps the compiler from dropping the integrators)
+        std::cout << name << "  " << single << " s  " << packet << " s  (" << sum << ")\n";
+    }
+    std::cout << mismatches << " of " << rays.size()
+              << " packet hits differ from the single ray hits" << std::endl;
+}
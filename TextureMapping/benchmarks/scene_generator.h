@@ -0,0 +1,72 @@
+#ifndef SCENE_GENERATOR_H
+#define SCENE_GENERATOR_H
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief The benchmarks generate their scenes as OBJ files in the temporary directory, so they can
+ * be reproduced without any assets and load the meshes like the application does.
+ */
+namespace scene_generator {
+
+/// small random triangles clustered around the z axis (a scene with lots of overlap, which needs
+/// a good BVH), returns the file name
+inline std::string writeTriangleSoup(std::string_view name, uint32_t numTriangles)
+{
+    const std::filesystem::path path = std::filesystem::temp_directory_path() / name;
+    std::ofstream out{path};
+    std::mt19937 rng{2};
+    std::normal_distribution<float> gauss{0.0f, 1.0f};
+    std::uniform_real_distribution<float> depth{-5.0f, 5.0f};
+    std::uniform_real_distribution<float> jitter{-0.01f, 0.01f};
+    for (uint32_t i = 0; i < numTriangles; ++i) {
+        const float x = gauss(rng), y = gauss(rng) * 0.3f, z = depth(rng);
+        for (uint32_t k = 0; k < 3; ++k)
+            out << "v " << x + jitter(rng) << ' ' << y + jitter(rng) << ' ' << z + jitter(rng)
+                << '\n';
+    }
+    for (uint32_t i = 0; i < numTriangles; ++i)
+        out << "f " << 3 * i + 1 << ' ' << 3 * i + 2 << ' ' << 3 * i + 3 << '\n';
+    return path.string();
+}
+
+/// a slightly bumpy grid of quads with texture coordinates and a normal, the first half of the
+/// rows is smooth (the typical content of exported OBJ files), returns the file name
+inline std::string writeQuadGrid(std::string_view name, uint32_t quadsPerSide)
+{
+    const std::filesystem::path path = std::filesystem::temp_directory_path() / name;
+    std::ofstream out{path};
+    out.setf(std::ios::fixed);
+    std::mt19937 rng{1};
+    std::uniform_real_distribution<float> bump{0.0f, 0.01f};
+    const float n = static_cast<float>(quadsPerSide);
+    out.precision(6);
+    for (uint32_t j = 0; j <= quadsPerSide; ++j)
+        for (uint32_t i = 0; i <= quadsPerSide; ++i)
+            out << "v " << i / n << ' ' << bump(rng) << ' ' << j / n << '\n';
+    out.precision(5);
+    for (uint32_t j = 0; j <= quadsPerSide; ++j)
+        for (uint32_t i = 0; i <= quadsPerSide; ++i)
+            out << "vt " << i / n << ' ' << j / n << '\n';
+    out << "vn 0 1 0\ns 1\n";
+    for (uint32_t j = 0; j < quadsPerSide; ++j) {
+        if (j == quadsPerSide / 2)
+            out << "s off\n";
+        for (uint32_t i = 0; i < quadsPerSide; ++i) {
+            const uint64_t a = uint64_t{j} * (quadsPerSide + 1) + i + 1;
+            const uint64_t b = a + 1, c = a + quadsPerSide + 2, d = a + quadsPerSide + 1;
+            out << "f " << a << '/' << a << "/1 " << b << '/' << b << "/1 " << c << '/' << c
+                << "/1 " << d << '/' << d << "/1\n";
+        }
+    }
+    return path.string();
+}
+
+} // namespace scene_generator
+
+#endif // SCENE_GENERATOR_H
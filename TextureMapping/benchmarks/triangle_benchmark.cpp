@@ -0,0 +1,116 @@
+#include "scene_generator.h"
+
+#include <render/intersection.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+namespace {
+/**
+ * @brief The ray-triangle test used before the Moeller-Trumbore test (intersect the plane, then
+ * compute the barycentric coordinates from sub-triangle areas), kept as a reference.
+ */
+bool intersectByAreas(const BVH::LeafTriangle& triangle, const IntersectionRay& ray)
+{
+    const Vector3D v1v2 = triangle.v2 - triangle.v1;
+    const Vector3D v1v3 = triangle.v3 - triangle.v1;
+    const Normal3D normal = cross(v1v2, v1v3);
+    const float distance = dot(triangle.v1 - ray.origin, normal) / dot(ray.direction, normal);
+    if (!(distance >= ray.tMin && distance <= ray.tMax))
+        return false;
+
+    const Vector3D v1p = ray.origin + ray.direction * distance - triangle.v1;
+    const Vector3D bary2 = cross(v1p, v1v3);
+    if (dot(bary2, normal) < 0.0f)
+        return false;
+    const Vector3D bary3 = cross(v1v2, v1p);
+    if (dot(bary3, normal) < 0.0f)
+        return false;
+    const float invNorm = 1.0f / normal.norm();
+    return bary2.norm() * invNorm + bary3.norm() * invNorm <= 1.0f;
+}
+
+template <typename Test>
+double nanosecondsPerTest(const std::vector<Ray>& rays,
+                          const std::vector<BVH::LeafTriangle>& triangles, Test test)
+{
+    using Clock = std::chrono::steady_clock;
+    double seconds = 0.0;
+    size_t hits = 0;
+    // the first round warms up the caches
+    for (uint32_t round = 0; round < 2; ++round) {
+        const auto start = Clock::now();
+        for (const Ray& r : rays) {
+            const IntersectionRay ray{r};
+            for (const BVH::LeafTriangle& triangle : triangles)
+                hits += test(triangle, ray);
+        }
+        seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    }
+    // (printing the hits keeps the compiler from dropping the tests)
+    std::cout << hits / 2 << " hits, ";
+    return seconds * 1e9 / static_cast<double>(rays.size() * triangles.size());
+}
+} // namespace
+
+/// usage: triangle_benchmark [number of triangles] [number of edge rays]
+int main(int argc, char** argv)
+{
+    const uint32_t numTriangles = argc > 1 ? std::atoi(argv[1]) : 20000;
+    const uint32_t numEdgeRays = argc > 2 ? std::atoi(argv[2]) : 1000000;
+
+    // the leaf triangles of a BVH, in the order in which the traversal reads them
+    Mesh mesh{scene_generator::writeTriangleSoup("triangle_benchmark.obj", numTriangles)};
+    const std::vector<BVH::LeafTriangle>& triangles = mesh.getBVH().getTriangles();
+
+    std::mt19937 rng{1};
+    std::uniform_real_distribution<float> uniform{0.0f, 1.0f};
+    const AABB bounds = mesh.getBounds();
+    auto pointInBounds = [&] {
+        return bounds.min + bounds.extents() * Point3D{uniform(rng), uniform(rng), uniform(rng)};
+    };
+    std::vector<Ray> rays;
+    for (uint32_t i = 0; i < 256; ++i) {
+        const Point3D origin = pointInBounds();
+        rays.push_back(Ray{origin, normalize(pointInBounds() - origin)});
+    }
+
+#ifdef WATERTIGHT_INTERSECTION
+    const char* kernel = "watertight test";
+#else
+    const char* kernel = "Moeller-Trumbore test";
+#endif
+    std::cout << "area test: ";
+    std::cout << nanosecondsPerTest(rays, triangles, intersectByAreas) << " ns per test\n";
+    std::cout << kernel << ": ";
+    std::cout << nanosecondsPerTest(rays, triangles,
+                                    [](const BVH::LeafTriangle& triangle,
+                                       const IntersectionRay& ray) {
+                                        return static_cast<bool>(Intersection{triangle, ray});
+                                    })
+              << " ns per test\n";
+
+    // random quads split along a diagonal: rays aimed at the diagonal have to hit either triangle
+    std::uniform_real_distribution<float> coordinate{-10.0f, 10.0f};
+    auto randomVector = [&] { return Vector3D{coordinate(rng), coordinate(rng), coordinate(rng)}; };
+    uint32_t areaTestLeaks = 0, leaks = 0;
+    for (uint32_t i = 0; i < numEdgeRays; ++i) {
+        const Point3D p0 = randomVector();
+        const Vector3D edge1 = randomVector(), edge2 = randomVector();
+        const Point3D p2 = p0 + edge1 + edge2;
+        const BVH::LeafTriangle triangle1{p0, p0 + edge1, p2}, triangle2{p0, p2, p0 + edge2};
+        const Point3D target = p0 + (p2 - p0) * (0.01f + 0.98f * uniform(rng));
+        const Point3D origin = randomVector();
+        const IntersectionRay ray{Ray{origin, target - origin, 0.0f, 2.0f}};
+
+        areaTestLeaks += !intersectByAreas(triangle1, ray) && !intersectByAreas(triangle2, ray);
+        leaks += !Intersection{triangle1, ray} && !Intersection{triangle2, ray};
+    }
+    std::cout << "rays through shared edges leaking through both triangles: area test "
+              << 100.0 * areaTestLeaks / numEdgeRays << "%, " << kernel << " "
+              << 100.0 * leaks / numEdgeRays << "%" << std::endl;
+}
@@ -0,0 +1,115 @@
+#ifndef BINARY_FILE_H
+#define BINARY_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/**
+ * @brief Read-only memory mapping of a whole file (the file is unmapped on destruction).
+ */
+class MappedFile {
+public:
+    /// map the given file, check operator bool for success
+    explicit MappedFile(const std::string& filename);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /// returns whether the file could be opened and mapped
+    explicit operator bool() const { return valid; }
+
+    /// the contents of the file
+    std::span<const std::byte> data() const { return {begin, size}; }
+
+private:
+    bool valid{false};
+    const std::byte* begin{nullptr};
+    size_t size{0};
+#ifdef _WIN32
+    void* fileHandle{nullptr};
+    void* mappingHandle{nullptr};
+#endif
+};
+
+/// 64 bit FNV-1a hash of the given data (processed in 8 byte words)
+inline uint64_t hashBytes(std::span<const std::byte> data)
+{
+    constexpr uint64_t prime{0x100000001b3ULL};
+    uint64_t hash{0xcbf29ce484222325ULL};
+
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= data.size(); i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data.data() + i, sizeof(word));
+        hash = (hash ^ word) * prime;
+    }
+    for (; i < data.size(); ++i)
+        hash = (hash ^ static_cast<uint64_t>(data[i])) * prime;
+
+    return hash;
+}
+
+/**
+ * @brief Sequential reader for data written with writeBinary, e.g. from a mapped file. All reads
+ * fail once the end of the data is reached.
+ */
+class BinaryReader {
+public:
+    explicit BinaryReader(std::span<const std::byte> data) : data{data} {}
+
+    template <typename T>
+    bool read(T& value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        if (data.size() < sizeof(T))
+            return false;
+        std::memcpy(&value, data.data(), sizeof(T));
+        data = data.subspan(sizeof(T));
+        return true;
+    }
+
+    template <typename T>
+    bool read(std::vector<T>& values)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        uint64_t count;
+        if (!read(count) || count > data.size() / sizeof(T))
+            return false;
+        values.resize(count);
+        if (count)
+            std::memcpy(values.data(), data.data(), count * sizeof(T));
+        data = data.subspan(count * sizeof(T));
+        return true;
+    }
+
+    /// returns whether all data has been read
+    bool atEnd() const { return data.empty(); }
+
+private:
+    std::span<const std::byte> data;
+};
+
+template <typename T>
+void writeBinary(std::ostream& out, const T& value)
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+void writeBinary(std::ostream& out, const std::vector<T>& values)
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+    writeBinary(out, static_cast<uint64_t>(values.size()));
+    out.write(reinterpret_cast<const char*>(values.data()),
+              static_cast<std::streamsize>(values.size() * sizeof(T)));
+}
+
+#endif // BINARY_FILE_H
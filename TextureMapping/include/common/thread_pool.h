@@ -0,0 +1,91 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/**
+ * @brief Fixed number of worker threads executing tasks in the order they were submitted. Tasks
+ * that did not start yet are discarded on destruction (their futures report a broken promise).
+ */
+class ThreadPool {
+public:
+    explicit ThreadPool(uint32_t numThreads)
+    {
+        workers.reserve(numThreads);
+        for (uint32_t i = 0; i < std::max(numThreads, 1U); ++i)
+            workers.emplace_back([this] { work(); });
+    }
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard lock{mutex};
+            stopping = true;
+            tasks.clear();
+        }
+        wakeUp.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /// pool shared by the asset registries to load files in the background (the loaders themselves
+    /// may still use OpenMP)
+    static ThreadPool& getAssetLoaders()
+    {
+        static ThreadPool assetLoaders{std::thread::hardware_concurrency()};
+        return assetLoaders;
+    }
+
+    /// run the function on one of the workers, the future returns its result or rethrows its
+    /// exception
+    template <typename Function> auto submit(Function&& function)
+    {
+        using Result = std::invoke_result_t<std::decay_t<Function>>;
+        // std::function needs a copyable callable, the task itself is move-only
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<Function>(function));
+        std::future<Result> result = task->get_future();
+        {
+            std::lock_guard lock{mutex};
+            tasks.emplace_back([task] { (*task)(); });
+        }
+        wakeUp.notify_one();
+        return result;
+    }
+
+private:
+    void work()
+    {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock lock{mutex};
+                wakeUp.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (stopping)
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    bool stopping{false};
+};
+
+#endif // THREAD_POOL_H
@@ -26,6 +26,15 @@ struct AABB {
     /// returns the center of the bounding box
     Point3D center() const { return (min + max) * 0.5f; }
 
+    /// returns the surface area of the bounding box (zero if it is empty)
+    float surfaceArea() const
+    {
+        if (!(min <= max))
+            return 0.0f;
+        const Vector3D e = extents();
+        return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+
     /// checks whether the point is contained in the bounding box
     bool contains(const Point3D& p) const { return p >= min && p <= max; }
 
@@ -38,6 +47,12 @@ struct AABB {
         return {::min(min, other.min), ::max(max, other.max)};
     }
 
+    /// return the bounding box contained in this and the other bounding box (empty if disjoint)
+    AABB intersection(const AABB& other) const
+    {
+        return {::max(min, other.min), ::min(max, other.max)};
+    }
+
     /// extend the bounding box to also contain the other bounding box
     AABB& operator+=(const AABB& other)
     {
@@ -5,10 +5,12 @@
 #if __cpp_lib_span >= 202002L
 #include <span>
 #endif
+#include <iosfwd>
 #include <vector>
 
 #include "aabb.h"
 
+class BinaryReader;
 class Mesh;
 
 class BVH {
@@ -20,45 +22,238 @@ public:
     static constexpr uint32_t maxDepth{20};
     static_assert(maxDepth >= 1 && maxDepth <= 32, "maxDepth needs to be between 1 and 32");
 
-    struct Node {
+    /// strategy used to partition the faces of an inner node
+    enum class SplitMethod {
+        /// split at the median face center along the longest axis of the node
+        Median,
+        /// binned surface area heuristic (slowest build, fastest traversal)
+        SAH,
+        /// linear BVH: sort the faces by the Morton code of their centers and split at the
+        /// highest differing bit (fastest build, e.g. for rebuilding deforming meshes)
+        Morton
+    };
+
+    struct BuildParameters {
+        SplitMethod splitMethod{SplitMethod::Median};
+        /// number of bins per axis used to evaluate the surface area heuristic (at most 64)
+        uint32_t numBins{16};
+        /// largest leaf the SAH builder may create if splitting would be more expensive (values
+        /// below numFacesPerLeaf also make the other split methods create smaller leaves)
+        uint32_t maxFacesPerLeaf{8};
+        /// estimated cost of visiting an inner node (relative to one triangle test)
+        float traversalCost{1.0f};
+        /// estimated cost of intersecting a ray with one triangle
+        float intersectionCost{1.0f};
+        /// build disjoint subtrees on all cores (the resulting tree is the same)
+        bool parallel{true};
+        /// collapse the binary tree into wide nodes, which are used for traversal
+        bool wideNodes{true};
+        /// refit() rebuilds the tree once its SAH cost exceeds this multiple of the cost after the
+        /// last build (zero disables rebuilding)
+        float maxSAHCostIncrease{2.0f};
+        /// number of passes that restructure small treelets to reduce the SAH cost after the
+        /// build (zero disables them), mostly useful for the median and Morton split methods
+        uint32_t treeletOptimizationPasses{0};
+    };
+
+    /// marks leaf nodes in Node::offset
+    static constexpr uint32_t leafFlag{1U << 31};
+
+    /**
+     * @brief A node of the depth-first linearized tree: the left child of an inner node directly
+     * follows its parent, and each subtree occupies a contiguous range of nodes.
+     */
+    struct alignas(32) Node {
         /// bounding box of all contained triangles
         AABB bounds;
-        /// first index into faceIndices
-        uint32_t facesBegin{0};
-        /// one past the last index into faceIndices
-        uint32_t facesEnd{0};
+        /// inner nodes: index of the right child
+        /// leaf nodes: first index into faceIndices, marked with leafFlag
+        uint32_t offset{leafFlag};
+        /// inner nodes: index of the first node after this subtree
+        /// leaf nodes: one past the last index into faceIndices
+        uint32_t end{0};
+
+        bool isLeaf() const { return offset & leafFlag; }
+
+        /// first index into faceIndices (leaf nodes only)
+        uint32_t facesBegin() const { return offset & ~leafFlag; }
+        /// one past the last index into faceIndices (leaf nodes only)
+        uint32_t facesEnd() const { return end; }
+
+        /// index of the right child (inner nodes only, the left child is at this node's index + 1)
+        uint32_t rightChild() const { return offset; }
+        /// index of the node to continue with if this subtree is skipped (inner nodes only)
+        uint32_t skip() const { return end; }
+    };
+    static_assert(sizeof(Node) == 32, "BVH nodes should fit into half a cache line");
+
+    /**
+     * @brief Vertices of a triangle, copied from the mesh in leaf order so that leaves can be
+     * intersected by streaming through memory instead of gathering the vertices. The exact
+     * vertices (instead of edges) let triangles sharing an edge compute identical edge tests.
+     */
+    struct LeafTriangle {
+        Point3D v1;
+        Point3D v2;
+        Point3D v3;
+    };
+
+    /// number of children of a wide node (one SIMD register per coordinate of the child bounds)
+#if defined(__AVX__)
+    static constexpr uint32_t wideNodeWidth{8};
+#else
+    static constexpr uint32_t wideNodeWidth{4};
+#endif
+
+    /**
+     * @brief A node of the wide BVH: the bounds of all children are stored as structure of arrays,
+     * so they can be tested against a ray at once. Unused slots contain empty leaves.
+     */
+    struct alignas(32) WideNode {
+        /// bounds of the children, one array per coordinate
+        float minX[wideNodeWidth], minY[wideNodeWidth], minZ[wideNodeWidth];
+        float maxX[wideNodeWidth], maxY[wideNodeWidth], maxZ[wideNodeWidth];
+        /// like Node::offset: index of an inner child in wideNodes or first face of a leaf
+        uint32_t offset[wideNodeWidth];
+        /// one past the last face of a leaf child
+        uint32_t end[wideNodeWidth];
+
+        bool isLeaf(uint32_t child) const { return offset[child] & leafFlag; }
+        uint32_t facesBegin(uint32_t child) const { return offset[child] & ~leafFlag; }
+        uint32_t facesEnd(uint32_t child) const { return end[child]; }
+    };
+
+    /// number of triangles in a packet (tested at once by the SIMD leaf test)
+    static constexpr uint32_t trianglePacketWidth{8};
+
+    /**
+     * @brief The leaf triangles as structure of arrays: packet i holds the triangles
+     * [i * trianglePacketWidth, (i + 1) * trianglePacketWidth) of the leaf order, so a leaf covers
+     * parts of at most two packets for typical leaf sizes. Unused slots are degenerate.
+     */
+    struct alignas(32) TrianglePacket {
+        float v1X[trianglePacketWidth], v1Y[trianglePacketWidth], v1Z[trianglePacketWidth];
+        float v1v2X[trianglePacketWidth], v1v2Y[trianglePacketWidth], v1v2Z[trianglePacketWidth];
+        float v1v3X[trianglePacketWidth], v1v3Y[trianglePacketWidth], v1v3Z[trianglePacketWidth];
     };
 
     BVH() = default;
 
     /// construct a BVH for the given mesh (implemented in exercise03.cpp)
-    void construct(const Mesh& mesh);
+    void construct(const Mesh& mesh, const BuildParameters& params);
+    /// construct a BVH for the given mesh using the default parameters
+    void construct(const Mesh& mesh) { construct(mesh, {}); }
+#if __cpp_lib_span >= 202002L
+    /// construct a BVH over arbitrary primitives given by their bounding boxes, e.g. the instances
+    /// of a scene (the leaves reference the indices of the boxes, no triangles are stored)
+    void construct(std::span<const AABB> primitiveBounds, const BuildParameters& params);
+#endif
+
+    /**
+     * @brief Update the bounds of all nodes after the vertices of the mesh were moved, keeping the
+     * topology of the tree. Refitting is much cheaper than a rebuild, but the tree degrades with
+     * larger deformations, so it is rebuilt with the previous parameters once its SAH cost exceeds
+     * BuildParameters::maxSAHCostIncrease (or if the number of faces changed).
+     */
+    void refit(const Mesh& mesh);
+
+    /// write the tree to a binary stream (used to cache the BVH on disk)
+    void write(std::ostream& out) const;
+    /// read a tree written by write() for a mesh with the given number of faces, returns false
+    /// if the data is invalid
+    bool read(BinaryReader& in, size_t numFaces);
 
     bool isConstructed() const { return !nodes.empty(); }
 
-    /// return all the nodes in the BVH
+    /// expected cost of intersecting a ray with the tree (surface area heuristic)
+    float computeSAHCost() const;
+
+    /// quality and memory statistics of a BVH
+    struct Stats {
+        /// expected cost of intersecting a ray with the tree (see computeSAHCost)
+        float sahCost{0.0f};
+        uint32_t numNodes{0};
+        uint32_t numLeaves{0};
+        /// leaves without faces and nodes with empty bounds
+        uint32_t numEmptyNodes{0};
+        /// number of leaves at each depth
+        std::vector<uint32_t> depthHistogram;
+        /// number of leaves for each number of faces
+        std::vector<uint32_t> leafSizeHistogram;
+        /// surface area of the overlap of both children relative to the surface area of their
+        /// parent, averaged over all inner nodes
+        float averageSiblingOverlap{0.0f};
+        /// memory used by the binary and wide nodes
+        size_t nodeBytes{0};
+        /// memory used by the face indices and the leaf triangles
+        size_t faceBytes{0};
+    };
+    /// compute the statistics of the tree (iterates over all nodes)
+    Stats computeStats() const;
+
+    /// return all the nodes in the BVH (in depth-first order, the root node comes first)
     const std::vector<Node>& getNodes() const { return nodes; }
+    /// return the wide nodes (empty if the tree was not collapsed, the root node comes first)
+    const std::vector<WideNode>& getWideNodes() const { return wideNodes; }
+    /// return the triangles of all leaves (a leaf references the range [facesBegin, facesEnd))
+    const std::vector<LeafTriangle>& getTriangles() const { return triangles; }
+    /// return the same triangles packed for the SIMD leaf test
+    const std::vector<TrianglePacket>& getTrianglePackets() const { return trianglePackets; }
+    /// return the index of the mesh face that is stored at position i of the leaf order
+    uint32_t getFaceIndex(uint32_t i) const { return faceIndices[i]; }
 #if __cpp_lib_span >= 202002L
-    /// return all face indices belonging to a specific node
+    /// return all face indices belonging to a specific leaf node
     std::span<const uint32_t> getFaceIndices(const Node& node) const
     {
-        return {faceIndices.data() + node.facesBegin, faceIndices.data() + node.facesEnd};
+        return {faceIndices.data() + node.facesBegin(), faceIndices.data() + node.facesEnd()};
     }
 #endif
 
 private:
-#if __cpp_lib_span >= 202002L
-    /// return all face indices belonging to a specific node
-    std::span<uint32_t> getFaceIndices(const Node& node)
-    {
-        return {faceIndices.data() + node.facesBegin, faceIndices.data() + node.facesEnd};
-    }
-#endif
+    struct BuildContext;
+    struct BuildNode;
+    struct TreeletOptimizer;
+
+    /// build the tree over the given primitives, returns the SAH cost before treelet optimization
+    float build(const AABB& bounds, std::vector<AABB>&& primitiveBounds,
+                std::vector<Point3D>&& centroids, const BuildParameters& params);
+    /// partition the faces of the node and compute its children (returns false for leaves)
+    bool splitNode(const BuildNode& node, BuildNode& left, BuildNode& right,
+                   const BuildContext& context, bool parallel);
+    /// build the subtree below tree[0] on the calling thread, appending all new nodes to tree
+    void constructSubtree(std::vector<BuildNode>& tree, const BuildContext& context);
+    /// compute the bounds of all nodes from their children (or faces for leaf nodes)
+    void computeBoundsBottomUp(std::vector<BuildNode>& tree, const BuildContext& context,
+                               bool parallel);
+    /// restructure treelets to minimize the SAH cost, returns the SAH cost before the optimization
+    float optimizeTreelets(std::vector<BuildNode>& tree, const BuildParameters& params);
+    /// store the tree in depth-first order
+    void linearize(const std::vector<BuildNode>& tree);
+    /// copy the triangles of the mesh in the order of faceIndices
+    void storeTriangles(const Mesh& mesh, bool parallel);
+    /// pack the stored triangles into trianglePackets
+    void packTriangles(bool parallel);
+    /// collapse the binary tree into wide nodes
+    void collapse();
 
-    /// full binary tree - some nodes might be empty (facesBegin == facesEnd == 0)
+    /// parameters of the last build (used for rebuilds by refit)
+    BuildParameters buildParameters;
+    /// SAH cost of the tree after the last build
+    float builtSAHCost{0.0f};
+
+    /// all nodes in depth-first order
     std::vector<Node> nodes;
+    /// nodes with wideNodeWidth children (used for traversal)
+    std::vector<WideNode> wideNodes;
     /// re-organized array containing all face indices (referenced by the BVH nodes)
     std::vector<uint32_t> faceIndices;
+    /// triangles of all faces in the order of faceIndices
+    std::vector<LeafTriangle> triangles;
+    /// vertex and edges of the triangles in packets (not stored in the cache)
+    std::vector<TrianglePacket> trianglePackets;
 };
 
+/// "to string" (on a single line, e.g. for logging)
+std::ostream& operator<<(std::ostream& os, const BVH::Stats& stats);
+
 #endif // BVH_H
@@ -1,6 +1,7 @@
 #ifndef MESH_H
 #define MESH_H
 
+#include <cassert>
 #include <string>
 #include <string_view>
 #include <utility>
@@ -71,6 +72,19 @@ struct BarycentricCoordinates {
     }
 };
 
+/**
+ * @brief Per-face attributes needed for shading, stored in a table next to the faces so that hits
+ * can look them up directly.
+ */
+struct FaceAttributes {
+    /// marks faces that are not part of a smooth group
+    static constexpr uint32_t flat{~0U};
+    /// index of the smooth group containing the face, or flat
+    uint32_t smoothGroup{flat};
+
+    bool isSmooth() const { return smoothGroup != flat; }
+};
+
 /**
  * @brief 3D Triangle Mesh
  */
@@ -85,8 +99,16 @@ public:
      * vertex normals and texture coordinates are ignored
      * all faces are merged into one object
      * @param filename
+     * @param parallel parse chunks of the file on all cores (the result is the same)
      */
-    void loadOBJ(const std::string_view filename);
+    void loadOBJ(const std::string_view filename, bool parallel = true);
+    /**
+     * @brief loadCached loads the mesh and its BVH from a binary cache next to the OBJ file
+     * (filename + ".cache") if it matches the size and content hash of the OBJ file, otherwise the
+     * OBJ file is loaded and the cache is (re-)written
+     * @param filename
+     */
+    void loadCached(const std::string_view filename);
 
     /// remove all vertices and faces
     void clear() { *this = {}; }
@@ -130,12 +152,14 @@ public:
     /// get the smooth groups (ranges of faces to be drawn with smooth shading)
     const std::vector<std::pair<size_t, size_t>>& getSmoothGroups() const { return smoothGroups; }
 
+    /// get the attributes of all faces (in the order of the faces)
+    const std::vector<FaceAttributes>& getFaceAttributes() const { return faceAttributes; }
+
+    /// faces without attributes (e.g. added through getFaces()) are flat
     bool isSmoothFace(uint32_t i) const
     {
-        for (auto [begin, end] : smoothGroups)
-            if (i < end)
-                return (i >= begin);
-        return false;
+        assert(i < faceAttributes.size() && "the face attributes are out of date");
+        return i < faceAttributes.size() && faceAttributes[i].isSmooth();
     }
 
     /// create a triangle from its vertex indices
@@ -158,8 +182,28 @@ public:
     }
 
     const BVH& getBVH() const { return bvh; }
+    /// re-build the BVH, e.g. to use a different split method
+    void buildBVH(const BVH::BuildParameters& params = {}) { bvh.construct(*this, params); }
+    /// update the bounds and the BVH after the vertices were moved (changing the faces forces a
+    /// rebuild of the BVH, added faces are flat)
+    void refitBVH()
+    {
+        if (faceAttributes.size() != faces.size())
+            computeFaceAttributes(true);
+        updateBounds();
+        bvh.refit(*this);
+    }
 
 private:
+    struct CacheHeader;
+
+    /// read the cache of the given OBJ file, returns false if it is missing or out of date
+    bool readCache(const std::string_view filename, const CacheHeader& header);
+    /// write the cache of the given OBJ file
+    void writeCache(const std::string_view filename, const CacheHeader& header) const;
+    /// derive the face attributes from the smooth groups
+    void computeFaceAttributes(bool parallel);
+
     /// the vertices of the mesh
     std::vector<Point3D> vertices;
     /// the triangle faces of the mesh
@@ -179,6 +223,8 @@ private:
     float invTotalArea{};
     /// smooth groups
     std::vector<std::pair<size_t, size_t>> smoothGroups;
+    /// attributes of each face (derived from the smooth groups, not stored in the cache)
+    std::vector<FaceAttributes> faceAttributes;
 
     /// Bounding-Volume-Hierarchy
     BVH bvh;
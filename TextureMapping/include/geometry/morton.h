@@ -0,0 +1,29 @@
+#ifndef MORTON_H
+#define MORTON_H
+
+#include "point3d.h"
+
+#include <algorithm>
+#include <cstdint>
+
+/// interleave the lower 10 bits of the given value with two zero bits each
+inline uint32_t expandBits(uint32_t v)
+{
+    v = (v * 0x00010001U) & 0xFF0000FFU;
+    v = (v * 0x00000101U) & 0x0F00F00FU;
+    v = (v * 0x00000011U) & 0xC30C30C3U;
+    v = (v * 0x00000005U) & 0x49249249U;
+    return v;
+}
+
+/// compute the 30 bit Morton code of a point given relative to the bounding box [0, 1]^3
+inline uint32_t mortonCode(const Point3D& p)
+{
+    auto quantize = [](float x) -> uint32_t {
+        return static_cast<uint32_t>(std::clamp(x * 1024.0f, 0.0f, 1023.0f));
+    };
+    return (expandBits(quantize(p.x)) << 2) | (expandBits(quantize(p.y)) << 1)
+         | expandBits(quantize(p.z));
+}
+
+#endif // MORTON_H
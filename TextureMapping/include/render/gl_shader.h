@@ -29,6 +29,8 @@ public:
 
 private:
     size_t numBVHNodes{0};
+    /// number of nodes in the first n levels of the BVH
+    std::vector<size_t> numBVHNodesAboveLevel;
     GLShaderProgram bvhShader;
     GLVertexBuffer vertexBuffer{};
 };
@@ -57,7 +59,9 @@ public:
     Matrix4D model;
 
 private:
-    std::vector<std::pair<size_t, size_t>> smoothGroups;
+    /// runs of consecutive faces [from, to) to be drawn with flat or smooth shading
+    std::vector<std::pair<size_t, size_t>> flatRanges;
+    std::vector<std::pair<size_t, size_t>> smoothRanges;
     size_t numTriangles{0};
 
     GLShaderProgram meshShader;
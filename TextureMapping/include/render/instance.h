@@ -2,17 +2,27 @@
 #define INSTANCE_H
 
 #include "material.h"
+#include "ray.h"
+#include <common/thread_pool.h>
 #include <geometry/matrix3d.h>
 #include <geometry/mesh.h>
 #include <geometry/point3d.h>
 
+#include <functional>
+#include <future>
+#include <iostream>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <string_view>
 #include <vector>
 
 namespace detail {
+/**
+ * @brief Owns all meshes loaded from files. Each file is loaded only once, even if it is requested
+ * again while it is still being loaded (failed loads are retried by later requests).
+ */
 class MeshRegistry {
 public:
     static MeshRegistry& getInstance()
@@ -20,17 +30,57 @@ public:
         static MeshRegistry instance;
         return instance;
     }
+    /// start loading the mesh (and building its BVH) in the background, the future becomes ready
+    /// once the mesh can be used
+    static std::shared_future<std::unique_ptr<const Mesh>>
+    loadMeshAsync(const std::string_view filename)
+    {
+        MeshRegistry& instance = getInstance();
+        std::lock_guard lock{instance.mutex};
+        auto it = instance.meshes.find(filename);
+        if (it == instance.meshes.end()) {
+            auto load = [filename = std::string{filename}, logBVHStats = instance.logBVHStats] {
+                try {
+                    auto mesh = std::make_unique<Mesh>();
+                    mesh->loadCached(filename);
+                    if (logBVHStats)
+                        std::cout << filename + ": " << mesh->getBVH().computeStats() << std::endl;
+                    return std::unique_ptr<const Mesh>{std::move(mesh)};
+                }
+                catch (...) {
+                    // forget the failed load, so that the file can be requested again (the
+                    // current requests still receive the error)
+                    MeshRegistry& registry = getInstance();
+                    std::lock_guard lock{registry.mutex};
+                    registry.meshes.erase(filename);
+                    throw;
+                }
+            };
+            it = instance.meshes
+                     .emplace(filename, ThreadPool::getAssetLoaders().submit(std::move(load)))
+                     .first;
+        }
+        return it->second;
+    }
+    /// load the mesh, waits until it is available (rethrows errors of the loader)
     static const Mesh* loadMesh(const std::string_view filename)
+    {
+        return loadMeshAsync(filename).get().get();
+    }
+    /// print the BVH statistics of each mesh after loading it
+    static void setLogBVHStats(bool log)
     {
         MeshRegistry& instance = getInstance();
-        if (!instance.meshes.contains(filename.data()))
-            instance.meshes.emplace(filename, std::make_unique<Mesh>(filename));
-        return instance.meshes.at(filename.data()).get();
+        std::lock_guard lock{instance.mutex};
+        instance.logBVHStats = log;
     }
 
 private:
     MeshRegistry() = default;
-    std::map<std::string, std::unique_ptr<Mesh>> meshes;
+    /// all meshes by file name (including the ones that are still being loaded)
+    std::map<std::string, std::shared_future<std::unique_ptr<const Mesh>>, std::less<>> meshes;
+    std::mutex mutex;
+    bool logBVHStats{false};
 };
 }; // namespace detail
 
@@ -45,6 +95,12 @@ struct Instance {
         : Instance{*detail::MeshRegistry::loadMesh(meshFilename), material, toWorld}
     {
     }
+    /// start loading a mesh in the background, so that constructing an instance from the file later
+    /// only waits for the rest of the load
+    static void prefetch(const std::string_view meshFilename)
+    {
+        detail::MeshRegistry::loadMeshAsync(meshFilename);
+    }
 
     const Mesh& mesh;
     const Material material{Material::Diffuse{Color{165 / 255.0f, 30 / 255.0f, 55 / 255.0f}}};
@@ -52,9 +108,41 @@ struct Instance {
     const HomogeneousTransformation3D toLocal{toWorld.inverse()};
     const Matrix3D normalToWorld{toLocal.m.transposed()};
 
+    /// transforms without rotation or scaling allow cheaper ray transformations
+    enum class TransformType { Identity, Translation, General };
+    const TransformType transformType{getTransformType(toWorld)};
+
+    /// transform the ray into the local space of the instance (distances stay the same, because
+    /// the direction is not normalized)
+    IntersectionRay rayToLocal(const IntersectionRay& ray) const
+    {
+        switch (transformType) {
+        case TransformType::Identity:
+            return ray;
+        case TransformType::Translation: {
+            // the direction and its inverse stay the same
+            IntersectionRay localRay{ray};
+            localRay.origin = ray.origin + toLocal.t;
+            return localRay;
+        }
+        default:
+            return Ray{toLocal * ray.origin, toLocal.m * ray.direction, ray.tMin, ray.tMax};
+        }
+    }
+
+    /// world space bounds of the instance (transforms all corners of the local bounds)
     AABB getBounds() const
     {
-        return {toWorld * mesh.getBounds().min, toWorld * mesh.getBounds().max};
+        const AABB& localBounds = mesh.getBounds();
+        if (transformType != TransformType::General)
+            return {toWorld * localBounds.min, toWorld * localBounds.max};
+
+        AABB bounds;
+        for (uint32_t corner = 0; corner < 8; ++corner)
+            bounds.extend(toWorld * Point3D{corner & 1 ? localBounds.max.x : localBounds.min.x,
+                                            corner & 2 ? localBounds.max.y : localBounds.min.y,
+                                            corner & 4 ? localBounds.max.z : localBounds.min.z});
+        return bounds;
     }
 
     std::pair<Point3D, Normal3D> samplePointAndNormal(Point2D sample) const
@@ -62,6 +150,17 @@ struct Instance {
         auto [p, n] = mesh.samplePointAndNormal(sample);
         return {toWorld * p, normalize(normalToWorld * n)};
     }
+
+private:
+    static TransformType getTransformType(const HomogeneousTransformation3D& transformation)
+    {
+        const Matrix3D identity{};
+        if (transformation.m.x != identity.x || transformation.m.y != identity.y
+            || transformation.m.z != identity.z)
+            return TransformType::General;
+        return transformation.t == Vector3D{0.0f} ? TransformType::Identity
+                                                  : TransformType::Translation;
+    }
 };
 
 #endif // INSTANCE_H
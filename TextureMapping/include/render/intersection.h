@@ -6,24 +6,96 @@
 #include <render/ray.h>
 #include <render/scene.h>
 
+#include <span>
+
+/**
+ * @brief Work done to intersect rays with the scene. The counters are only compiled in if
+ * TRAVERSAL_STATISTICS is defined (e.g. in debug builds), otherwise this struct is empty and
+ * counting does nothing.
+ */
+struct TraversalCounters {
+#ifdef TRAVERSAL_STATISTICS
+    /// number of BVH nodes whose children were tested
+    uint64_t nodesVisited{0};
+    /// number of ray-box tests (one per child of each visited node)
+    uint64_t boxTests{0};
+    /// number of ray-triangle tests
+    uint64_t triangleTests{0};
+    /// number of occlusion queries (e.g. shadow rays)
+    uint64_t shadowRays{0};
+
+    void countNode(uint32_t numBoxTests)
+    {
+        ++nodesVisited;
+        boxTests += numBoxTests;
+    }
+    void countTriangleTests(uint32_t numTriangles) { triangleTests += numTriangles; }
+    void countShadowRay() { ++shadowRays; }
+
+    TraversalCounters& operator+=(const TraversalCounters& other)
+    {
+        nodesVisited += other.nodesVisited;
+        boxTests += other.boxTests;
+        triangleTests += other.triangleTests;
+        shadowRays += other.shadowRays;
+        return *this;
+    }
+#else
+    void countNode(uint32_t) {}
+    void countTriangleTests(uint32_t) {}
+    void countShadowRay() {}
+
+    TraversalCounters& operator+=(const TraversalCounters&) { return *this; }
+#endif
+
+    /// the counters of all scene queries of the calling thread (summed up by the ray tracer)
+    static TraversalCounters& thisThread();
+};
+
 struct Intersection {
     float distance{infinity};
     BarycentricCoordinates bary{};
     uint32_t triangleIndex{0};
     uint32_t instanceIndex{0};
+    [[no_unique_address]] TraversalCounters counters{};
 
     operator bool() const { return std::isfinite(distance); }
 
     Intersection() = default;
     // (implemented in exercise02.cpp)
     static bool intersect(const AABB& aabb, const IntersectionRay& ray);
+    /// test a box and compute the distance at which the ray enters it
+    static bool intersect(const AABB& aabb, const IntersectionRay& ray, float& tNear);
+    /// test all children of a wide BVH node at once, returns a bit mask of the children hit and
+    /// stores their entry distances in tNear (wideNodeWidth floats, aligned to 32 bytes)
+    static uint32_t intersect(const BVH::WideNode& node, const IntersectionRay& ray, float* tNear);
     // (implemented in exercise02.cpp)
-    Intersection(const Triangle& triangle, const IntersectionRay& ray);
+    Intersection(const Triangle& triangle, const IntersectionRay& ray)
+        : Intersection{BVH::LeafTriangle{triangle.v1, triangle.v2, triangle.v3}, ray}
+    {
+    }
+    /// intersect a ray with a triangle stored in the leaves of a BVH (Moeller-Trumbore test, or
+    /// the watertight test by Woop et al. if WATERTIGHT_INTERSECTION is defined)
+    Intersection(const BVH::LeafTriangle& triangle, const IntersectionRay& ray);
     // (implemented in exercise03.cpp)
     Intersection(const Mesh& mesh, const IntersectionRay& ray);
     // (implemented in intersection.cpp)
     /// intersect a ray with the scene
     Intersection(const Scene& scene, const IntersectionRay& ray);
+    /// intersect coherent rays (e.g. the camera rays of a pixel tile) with the scene at once,
+    /// diverging rays are traced one by one
+    static void intersect(const Scene& scene, std::span<const Ray> rays,
+                          std::span<Intersection> intersections);
+
+    /// returns whether the ray hits the triangle
+    static bool occluded(const BVH::LeafTriangle& triangle, const IntersectionRay& ray);
+    /// returns whether the ray hits any triangle of the mesh (stops at the first hit)
+    static bool occluded(const Mesh& mesh, const IntersectionRay& ray);
+    /// the same, adding the work done to the given counters
+    static bool occluded(const Mesh& mesh, const IntersectionRay& ray,
+                         TraversalCounters& counters);
+    /// returns whether the ray hits anything in the scene, e.g. for shadow rays
+    static bool occluded(const Scene& scene, const IntersectionRay& ray);
 };
 
 struct ShadingIntersection : public Intersection {
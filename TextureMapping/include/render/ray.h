@@ -4,6 +4,8 @@
 #include <common/constants.h>
 #include <geometry/point3d.h>
 
+#include <utility>
+
 struct Ray {
     Point3D origin;
     Vector3D direction;
@@ -19,9 +21,42 @@ struct Ray {
     }
 };
 
+#ifdef WATERTIGHT_INTERSECTION
+/**
+ * @brief Permutes and shears space so that the ray direction becomes the positive z axis (the
+ * largest component of the direction is mapped to z). Used by the watertight triangle test.
+ */
+struct RayShear {
+    explicit RayShear(const Vector3D& direction)
+    {
+        const uint8_t kz = abs(direction).maxDimension();
+        uint8_t kx = (kz + 1) % 3;
+        uint8_t ky = (kx + 1) % 3;
+        // keep the winding of the triangles
+        if (direction[kz] < 0.0f)
+            std::swap(kx, ky);
+
+        const float sz = 1.0f / direction[kz];
+        x[kx] = 1.0f;
+        x[kz] = -direction[kx] * sz;
+        y[ky] = 1.0f;
+        y[kz] = -direction[ky] * sz;
+        z[kz] = sz;
+    }
+
+    /// transform a point given relative to the ray origin
+    Point3D operator()(const Vector3D& p) const { return {dot(p, x), dot(p, y), dot(p, z)}; }
+
+    Vector3D x{0.0f}, y{0.0f}, z{0.0f};
+};
+#endif
+
 struct IntersectionRay final : public Ray {
     // component-wise inverse of ray direction for faster intersection tests
     const Vector3D inv_direction{direction.inverse()};
+#ifdef WATERTIGHT_INTERSECTION
+    const RayShear shear{direction};
+#endif
     // allow implicit conversion from basic ray
     IntersectionRay(const Ray& r) : Ray{r} {}
 };
@@ -1,6 +1,8 @@
 #ifndef RAYTRACER_H
 #define RAYTRACER_H
 #include <atomic>
+#include <mutex>
+#include <span>
 #include <thread>
 
 #include "camera.h"
@@ -10,13 +12,23 @@
 #include "scene.h"
 
 struct RayTracerParameters {
-    enum class RenderMode { Depth, Position, Normal, Whitted, Path };
+    /// Wavefront computes the same image as Path, but traces batches of paths in stages,
+    /// TraversalCost shows the BVH work per camera ray (needs TRAVERSAL_STATISTICS, black otherwise)
+    enum class RenderMode { Depth, Position, Normal, Whitted, Path, Wavefront, TraversalCost };
 
     RenderMode mode{RenderMode::Whitted};
     /// maximum number of samples per pixel to render (don't burn the CPU too much)
     uint16_t maxSPP{32};
     /// maximum number of ray bounces
     uint16_t maxDepth{6};
+    /// Wavefront mode: sort the secondary rays of a batch by origin and direction before tracing
+    /// them, so that similar rays visit the same BVH nodes one after another (only pays off if the
+    /// scene does not fit into the caches)
+    bool sortSecondaryRays{false};
+    /// TraversalCost mode: cost of a camera ray (BVH nodes visited plus triangles tested) shown in
+    /// red, cheaper rays fade over yellow, green and cyan to blue (a fixed scale, so that all
+    /// pixels and frames are comparable)
+    uint32_t maxTraversalCost{256};
 
     bool operator==(const RayTracerParameters& other) const = default;
 };
@@ -41,12 +53,53 @@ public:
     const Scene& getScene() const { return scene; }
     const Camera& getCamera() const { return camera; }
     const Film& getFilm() const { return film; }
+    /// work done by all threads for the last completely rendered sample per pixel (all zero unless
+    /// TRAVERSAL_STATISTICS is defined)
+    TraversalCounters getFrameCounters() const
+    {
+        std::lock_guard lock{frameCountersMutex};
+        return frameCounters;
+    }
 
-    Color depthIntegrator(const Ray& cameraRay) const;
-    Color positionIntegrator(const Ray& cameraRay) const;
-    Color normalIntegrator(const Ray& cameraRay) const;
+    Color depthIntegrator(const Ray& cameraRay) const
+    {
+        return depthIntegrator(cameraRay, {scene, cameraRay});
+    }
+    Color positionIntegrator(const Ray& cameraRay) const
+    {
+        return positionIntegrator(cameraRay, {scene, cameraRay});
+    }
+    Color normalIntegrator(const Ray& cameraRay) const
+    {
+        return normalIntegrator(cameraRay, {scene, cameraRay});
+    }
     Color whittedIntegrator(const Ray& cameraRay, uint32_t depth = 0) const;
-    Color pathIntegrator(const Ray& cameraRay) const;
+    /// false color heat map of the nodes visited and triangles tested by the camera ray, relative
+    /// to RayTracerParameters::maxTraversalCost
+    Color traversalCostIntegrator(const Ray& cameraRay) const;
+    Color pathIntegrator(const Ray& cameraRay) const
+    {
+        return pathIntegrator(cameraRay, {scene, cameraRay});
+    }
+
+    // the same integrators, continuing from the already computed first hit of the ray
+    Color depthIntegrator(const Ray& cameraRay, const Intersection& cameraHit) const;
+    Color positionIntegrator(const Ray& cameraRay, const Intersection& cameraHit) const;
+    Color normalIntegrator(const Ray& cameraRay, const Intersection& cameraHit) const;
+    Color whittedIntegrator(const Ray& cameraRay, const Intersection& cameraHit,
+                            uint32_t depth = 0) const;
+    Color pathIntegrator(const Ray& cameraRay, const Intersection& cameraHit) const;
+    /**
+     * @brief Path tracing of a batch of camera rays (e.g. all pixels of a block) in stages: all
+     * paths are extended, then shaded grouped by the kind of material, then the shadow rays of all
+     * paths are traced, instead of following each path to its end. Computes the same estimate as
+     * pathIntegrator for every ray.
+     */
+    void wavefrontPathIntegrator(std::span<const Ray> cameraRays,
+                                 std::span<const Intersection> cameraHits,
+                                 std::span<Color> colors) const;
+    /// compute the color of a camera ray with the integrator of the current render mode
+    Color integrate(const Ray& cameraRay, const Intersection& cameraHit) const;
 
     Color computeDirectLight(const ShadingIntersection& its, const Vector3D omegaO,
                              bool pointLightsOnly = false) const;
@@ -63,9 +116,13 @@ private:
     mutable std::atomic_bool new_sample_available{false};
     uint16_t sppRendered{};
     float partialSPPRendered{};
+    TraversalCounters frameCounters{};
+    mutable std::mutex frameCountersMutex;
 
 private:
     void render();
+    /// sum up and reset the counters of all threads of the OpenMP team
+    static TraversalCounters collectThreadCounters();
 };
 
 #endif // !RAYTRACER_H
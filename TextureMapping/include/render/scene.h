@@ -4,6 +4,7 @@
 #include "instance.h"
 #include "light.h"
 #include "material.h"
+#include <geometry/bvh.h>
 #include <geometry/matrix3d.h>
 #include <geometry/mesh.h>
 #include <geometry/point3d.h>
@@ -29,9 +30,33 @@ public:
 
     AABB getBounds() const { return bounds; }
 
+    /// build the top-level BVH over the world space bounds of all instances (instances added
+    /// afterwards are still found, but tested one by one)
+    void buildInstanceBVH()
+    {
+        std::vector<AABB> instanceBounds;
+        instanceBounds.reserve(instances.size());
+        for (const Instance& instance : instances)
+            instanceBounds.push_back(instance.getBounds());
+
+        BVH::BuildParameters params;
+        params.splitMethod = BVH::SplitMethod::SAH;
+        params.maxFacesPerLeaf = 2;
+        params.parallel = false;
+        instanceBVH.construct(instanceBounds, params);
+        numIndexedInstances = instances.size();
+    }
+
+    /// the leaves reference indices into the instances
+    const BVH& getInstanceBVH() const { return instanceBVH; }
+    /// number of instances contained in the top-level BVH (the first ones)
+    size_t getNumIndexedInstances() const { return numIndexedInstances; }
+
     std::vector<Instance> instances;
     std::vector<Light> lights;
     AABB bounds;
+    BVH instanceBVH;
+    size_t numIndexedInstances{0};
 };
 
 #endif // !SCENE_H
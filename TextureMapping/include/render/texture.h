@@ -6,8 +6,11 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <functional>
+#include <future>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <span>
 #include <string>
 #include <string_view>
@@ -38,6 +41,8 @@ public:
     Texture(Resolution resolution, Channels channels, DataType dataType, std::byte* data = nullptr);
     /// load a texture from a file
     Texture(std::string_view filename);
+    /// start loading a texture file in the background (see Texture(std::string_view))
+    static void prefetch(std::string_view filename);
 
     /// returns true if this texture holds some data
     operator bool() const { return data; }
@@ -69,15 +74,24 @@ public:
         static TextureRegistry instance;
         return instance;
     }
-    static const Texture& loadTexture(std::string_view filename);
+    /// start loading the texture in the background (each file is loaded only once, even if it is
+    /// requested again while it is still being loaded, failed loads are retried by later requests)
+    static std::shared_future<Texture> loadTextureAsync(std::string_view filename);
+    /// load the texture, waits until it is available (rethrows errors of the loader)
+    static const Texture& loadTexture(std::string_view filename)
+    {
+        return loadTextureAsync(filename).get();
+    }
     static void allocateData(Texture& texture);
 
 private:
     TextureRegistry() = default;
-    /// all textures that have been loaded by name
-    std::map<std::string, Texture> textures;
+    /// all textures that have been loaded (or are being loaded) by name
+    std::map<std::string, std::shared_future<Texture>, std::less<>> textures;
     /// holds all texture data in the program
     std::vector<std::unique_ptr<std::byte[]>> textureData;
+    /// guards both containers, textures are loaded on the asset loader threads
+    std::mutex mutex;
 };
 }; // namespace detail
 
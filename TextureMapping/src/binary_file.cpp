@@ -0,0 +1,86 @@
+#include <common/binary_file.h>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile(const std::string& filename)
+{
+    fileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                             FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (fileHandle == INVALID_HANDLE_VALUE) {
+        fileHandle = nullptr;
+        return;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(fileHandle, &fileSize))
+        return;
+    size = static_cast<size_t>(fileSize.QuadPart);
+
+    // empty files cannot be mapped
+    if (size == 0) {
+        valid = true;
+        return;
+    }
+
+    mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mappingHandle)
+        return;
+
+    begin = static_cast<const std::byte*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+    valid = begin != nullptr;
+}
+
+MappedFile::~MappedFile()
+{
+    if (begin)
+        UnmapViewOfFile(begin);
+    if (mappingHandle)
+        CloseHandle(mappingHandle);
+    if (fileHandle)
+        CloseHandle(fileHandle);
+}
+#else
+MappedFile::MappedFile(const std::string& filename)
+{
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+
+    struct stat fileStatus;
+    if (fstat(fd, &fileStatus) == 0) {
+        size = static_cast<size_t>(fileStatus.st_size);
+
+        // empty files cannot be mapped
+        if (size == 0) {
+            valid = true;
+        }
+        else {
+            void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping != MAP_FAILED) {
+                begin = static_cast<const std::byte*>(mapping);
+                valid = true;
+            }
+        }
+    }
+
+    // the mapping stays valid after closing the file
+    close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (begin)
+        munmap(const_cast<std::byte*>(begin), size);
+}
+#endif
@@ -1,19 +1,387 @@
+#include <common/binary_file.h>
 #include <geometry/bvh.h>
 #include <geometry/mesh.h>
+#include <geometry/morton.h>
 #include <render/intersection.h>
 #include <render/ray.h>
 
 #include <algorithm>
+#include <array>
 #include <bit>
+#include <cmath>
+#include <cstddef>
 #include <iostream>
 #include <limits>
+#include <numeric>
+#include <span>
 
-void BVH::construct(const Mesh& mesh)
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if defined(_WIN32)
+using OMPIndex = int32_t;
+#else
+using OMPIndex = uint32_t;
+#endif
+
+namespace {
+/// maximum number of bins per axis supported by the SAH builder
+constexpr uint32_t maxNumBins{64};
+/// nodes with more faces compute their bounds and bins with all threads
+constexpr uint32_t minFacesForParallelReduction{1U << 16};
+/// nodes with fewer faces are built as a whole by a single thread
+constexpr uint32_t maxFacesPerSubtree{1U << 12};
+
+/// a bin of the binned surface area heuristic
+struct SAHBin {
+    AABB bounds;
+    uint32_t numFaces{0};
+};
+
+using SAHBins = std::array<std::array<SAHBin, maxNumBins>, 3>;
+
+/// the cheapest split found by the binned surface area heuristic
+struct SAHSplit {
+    /// split dimension
+    uint8_t dim{0};
+    /// faces in bins [0, bin) go to the left child, all others to the right child
+    uint32_t bin{0};
+    /// estimated cost of the split (infinity if no valid split exists)
+    float cost{infinity};
+};
+
+/// maps the centroid coordinates of a node's faces to bins
+struct SAHBinning {
+    uint32_t numBins;
+    Point3D offset;
+    Point3D scale;
+
+    uint32_t binIndex(const Point3D& centroid, uint8_t dim) const
+    {
+        const float bin = (centroid[dim] - offset[dim]) * scale[dim];
+        return std::min(numBins - 1, static_cast<uint32_t>(std::max(bin, 0.0f)));
+    }
+};
+
+/// compute the union of the given bounding boxes, using all threads for large ranges
+AABB reduceBounds(std::span<const uint32_t> faces, const std::vector<AABB>& boxes, bool parallel)
+{
+    AABB result;
+    if (!parallel || faces.size() < minFacesForParallelReduction) {
+        for (uint32_t faceIndex : faces)
+            result += boxes[faceIndex];
+        return result;
+    }
+
+#pragma omp parallel
+    {
+        AABB local;
+#pragma omp for nowait
+        for (OMPIndex i = 0; i < static_cast<OMPIndex>(faces.size()); ++i)
+            local += boxes[faces[i]];
+#pragma omp critical
+        result += local;
+    }
+    return result;
+}
+
+/// compute the union of the given centroids, using all threads for large ranges
+AABB reduceCentroids(std::span<const uint32_t> faces, const std::vector<Point3D>& centroids,
+                     bool parallel)
+{
+    AABB result;
+    if (!parallel || faces.size() < minFacesForParallelReduction) {
+        for (uint32_t faceIndex : faces)
+            result.extend(centroids[faceIndex]);
+        return result;
+    }
+
+#pragma omp parallel
+    {
+        AABB local;
+#pragma omp for nowait
+        for (OMPIndex i = 0; i < static_cast<OMPIndex>(faces.size()); ++i)
+            local.extend(centroids[faces[i]]);
+#pragma omp critical
+        result += local;
+    }
+    return result;
+}
+
+/// sort the given faces into the bins of all three dimensions
+void fillBins(std::span<const uint32_t> faces, const std::vector<AABB>& faceBounds,
+              const std::vector<Point3D>& centroids, const SAHBinning& binning, SAHBins& bins,
+              bool parallel)
+{
+    auto addFace = [&](SAHBins& target, uint32_t faceIndex) {
+        for (uint8_t dim = 0; dim < 3; ++dim) {
+            SAHBin& bin = target[dim][binning.binIndex(centroids[faceIndex], dim)];
+            bin.bounds += faceBounds[faceIndex];
+            ++bin.numFaces;
+        }
+    };
+
+    bins = {};
+    if (!parallel || faces.size() < minFacesForParallelReduction) {
+        for (uint32_t faceIndex : faces)
+            addFace(bins, faceIndex);
+        return;
+    }
+
+#pragma omp parallel
+    {
+        SAHBins local{};
+#pragma omp for nowait
+        for (OMPIndex i = 0; i < static_cast<OMPIndex>(faces.size()); ++i)
+            addFace(local, faces[i]);
+#pragma omp critical
+        for (uint8_t dim = 0; dim < 3; ++dim) {
+            for (uint32_t i = 0; i < binning.numBins; ++i) {
+                bins[dim][i].bounds += local[dim][i].bounds;
+                bins[dim][i].numFaces += local[dim][i].numFaces;
+            }
+        }
+    }
+}
+
+/**
+ * @brief stable least significant digit radix sort of the values by their 32 bit keys
+ * the threads count the digits of contiguous chunks and scatter them to disjoint ranges
+ */
+void radixSort(std::vector<uint32_t>& keys, std::vector<uint32_t>& values, bool parallel)
+{
+    constexpr uint32_t bitsPerDigit = 8;
+    constexpr uint32_t numDigits = 1U << bitsPerDigit;
+    using Histogram = std::array<uint32_t, numDigits>;
+
+    const uint32_t size = static_cast<uint32_t>(keys.size());
+    std::vector<uint32_t> keysTemp(size);
+    std::vector<uint32_t> valuesTemp(size);
+    std::vector<Histogram> histograms;
+
+    for (uint32_t shift = 0; shift < 32; shift += bitsPerDigit) {
+        auto digit = [&](uint32_t key) -> uint32_t { return (key >> shift) & (numDigits - 1); };
+
+#pragma omp parallel if (parallel && size >= minFacesForParallelReduction)
+        {
+            uint32_t numChunks = 1;
+            uint32_t chunk = 0;
+#ifdef _OPENMP
+            numChunks = static_cast<uint32_t>(omp_get_num_threads());
+            chunk = static_cast<uint32_t>(omp_get_thread_num());
+#endif
+            const uint32_t begin = static_cast<uint32_t>(uint64_t{size} * chunk / numChunks);
+            const uint32_t end = static_cast<uint32_t>(uint64_t{size} * (chunk + 1) / numChunks);
+
+#pragma omp single
+            histograms.assign(numChunks, Histogram{});
+
+            for (uint32_t i = begin; i < end; ++i)
+                ++histograms[chunk][digit(keys[i])];
+
+#pragma omp barrier
+#pragma omp single
+            {
+                // exclusive prefix sum, ordered by digit first and chunk second
+                uint32_t offset = 0;
+                for (uint32_t d = 0; d < numDigits; ++d) {
+                    for (Histogram& histogram : histograms) {
+                        const uint32_t count = histogram[d];
+                        histogram[d] = offset;
+                        offset += count;
+                    }
+                }
+            }
+
+            Histogram& offsets = histograms[chunk];
+            for (uint32_t i = begin; i < end; ++i) {
+                const uint32_t target = offsets[digit(keys[i])]++;
+                keysTemp[target] = keys[i];
+                valuesTemp[target] = values[i];
+            }
+        }
+
+        keys.swap(keysTemp);
+        values.swap(valuesTemp);
+    }
+}
+} // namespace
+
+struct BVH::BuildContext {
+    const BuildParameters& params;
+    const bool useSAH;
+    const uint32_t numBins;
+    /// bounding box of each face
+    std::vector<AABB> faceBounds;
+    /// center of each face
+    std::vector<Point3D> centroids;
+    /// Morton codes of the faces in the order of faceIndices (only for SplitMethod::Morton)
+    std::vector<uint32_t> mortonCodes;
+    /// nodes at this depth are not split any further
+    uint32_t maxSplitDepth;
+};
+
+/// a node of the tree during construction (children are referenced explicitly)
+struct BVH::BuildNode {
+    /// bounding box of all contained triangles
+    AABB bounds;
+    /// first index into faceIndices
+    uint32_t facesBegin{0};
+    /// one past the last index into faceIndices
+    uint32_t facesEnd{0};
+    /// index of the left child (the right child follows it), zero for leaf nodes
+    uint32_t leftChild{0};
+    /// distance to the root node
+    uint32_t depth{0};
+
+    std::span<uint32_t> getFaces(std::vector<uint32_t>& faceIndices) const
+    {
+        return {faceIndices.data() + facesBegin, faceIndices.data() + facesEnd};
+    }
+};
+
+bool BVH::splitNode(const BuildNode& node, BuildNode& left, BuildNode& right,
+                    const BuildContext& context, bool parallel)
+{
+    const BuildParameters& params = context.params;
+    if (node.facesEnd - node.facesBegin <= std::clamp(params.maxFacesPerLeaf, 1U, numFacesPerLeaf)
+        || node.depth >= context.maxSplitDepth)
+        return false;
+
+    auto currentFaces = node.getFaces(faceIndices);
+    auto center = currentFaces.begin() + currentFaces.size() / 2;
+    bool medianSplit = true;
+
+    if (params.splitMethod == SplitMethod::Morton) {
+        // the faces are sorted by their codes, so split where the highest differing bit flips
+        const auto codesBegin = context.mortonCodes.cbegin() + node.facesBegin;
+        const auto codesEnd = context.mortonCodes.cbegin() + node.facesEnd;
+        const uint32_t differingBits = *codesBegin ^ *(codesEnd - 1);
+        // identical codes are split in the middle
+        if (differingBits) {
+            const uint32_t splitBit = std::bit_floor(differingBits);
+            const auto split = std::partition_point(
+                codesBegin, codesEnd, [&](uint32_t code) -> bool { return !(code & splitBit); });
+            center = currentFaces.begin() + std::distance(codesBegin, split);
+        }
+        medianSplit = false;
+    }
+    else if (context.useSAH) {
+        const AABB centroidBounds = reduceCentroids(currentFaces, context.centroids, parallel);
+
+        SAHBinning binning{context.numBins, centroidBounds.min, {}};
+        for (uint8_t dim = 0; dim < 3; ++dim) {
+            const float extent = centroidBounds.max[dim] - centroidBounds.min[dim];
+            binning.scale[dim] =
+                extent > 0.0f ? static_cast<float>(binning.numBins) / extent : 0.0f;
+        }
+
+        SAHBins bins;
+        fillBins(currentFaces, context.faceBounds, context.centroids, binning, bins, parallel);
+
+        const float nodeArea = node.bounds.surfaceArea();
+        const float invNodeArea = nodeArea > 0.0f ? 1.0f / nodeArea : 1.0f;
+
+        SAHSplit split;
+        std::array<AABB, maxNumBins> rightBounds;
+        for (uint8_t dim = 0; dim < 3; ++dim) {
+            // all centroids lie on a plane orthogonal to this dimension
+            if (binning.scale[dim] == 0.0f)
+                continue;
+
+            // sweep from the right to get the bounds of all possible right children
+            AABB accumulated;
+            for (uint32_t i = binning.numBins - 1; i > 0; --i) {
+                accumulated += bins[dim][i].bounds;
+                rightBounds[i] = accumulated;
+            }
+
+            // sweep from the left and evaluate the cost of splitting in front of bin i
+            accumulated = {};
+            uint32_t numLeft = 0;
+            for (uint32_t i = 1; i < binning.numBins; ++i) {
+                accumulated += bins[dim][i - 1].bounds;
+                numLeft += bins[dim][i - 1].numFaces;
+                const uint32_t numRight = static_cast<uint32_t>(currentFaces.size()) - numLeft;
+                if (!numLeft || !numRight)
+                    continue;
+
+                const float cost = params.traversalCost
+                                 + params.intersectionCost * invNodeArea
+                                       * (accumulated.surfaceArea() * static_cast<float>(numLeft)
+                                          + rightBounds[i].surfaceArea()
+                                                * static_cast<float>(numRight));
+                if (cost < split.cost)
+                    split = {dim, i, cost};
+            }
+        }
+
+        const float leafCost = params.intersectionCost * static_cast<float>(currentFaces.size());
+
+        // terminate early if intersecting all faces is cheaper than splitting
+        if (currentFaces.size() <= params.maxFacesPerLeaf && leafCost <= split.cost)
+            return false;
+
+        // fall back to the median split if all centroids fall into the same bin
+        if (std::isfinite(split.cost)) {
+            center = std::partition(currentFaces.begin(), currentFaces.end(),
+                                    [&](uint32_t faceIndex) -> bool {
+                                        return binning.binIndex(context.centroids[faceIndex],
+                                                                split.dim)
+                                             < split.bin;
+                                    });
+            medianSplit = false;
+        }
+    }
+
+    if (medianSplit) {
+        const uint8_t splitDim = node.bounds.extents().maxDimension();
+        std::nth_element(currentFaces.begin(), center, currentFaces.end(),
+                         [&](uint32_t a, uint32_t b) -> bool {
+                             return context.centroids[a][splitDim] < context.centroids[b][splitDim];
+                         });
+    }
+
+    left = {};
+    right = {};
+
+    left.facesBegin = node.facesBegin;
+    left.facesEnd = right.facesBegin =
+        node.facesBegin + static_cast<uint32_t>(std::distance(currentFaces.begin(), center));
+    right.facesEnd = node.facesEnd;
+    left.depth = right.depth = node.depth + 1;
+
+    // the bounds of a linear BVH are computed bottom-up once the topology is known
+    if (params.splitMethod != SplitMethod::Morton) {
+        left.bounds = reduceBounds(left.getFaces(faceIndices), context.faceBounds, parallel);
+        right.bounds = reduceBounds(right.getFaces(faceIndices), context.faceBounds, parallel);
+    }
+
+    return true;
+}
+
+void BVH::constructSubtree(std::vector<BuildNode>& tree, const BuildContext& context)
+{
+    for (size_t i = 0; i < tree.size(); ++i) {
+        BuildNode left;
+        BuildNode right;
+        if (!splitNode(tree[i], left, right, context, false))
+            continue;
+
+        tree[i].leftChild = static_cast<uint32_t>(tree.size());
+        tree.push_back(left);
+        tree.push_back(right);
+    }
+}
+
+void BVH::construct(const Mesh& mesh, const BuildParameters& params)
 {
     *this = {}; // clear all previous data
+    buildParameters = params;
 
-    if (mesh.getFaces().size() > std::numeric_limits<uint32_t>::max()) {
-        std::cerr << "mesh contains too many faces for 32bit indices" << std::endl;
+    if (mesh.getFaces().size() >= leafFlag) {
+        std::cerr << "mesh contains too many faces for 31bit indices" << std::endl;
         return;
     }
 
@@ -21,67 +389,751 @@ void BVH::construct(const Mesh& mesh)
 
     std::cout << "Building a BVH for a mesh containing " << numFaces << " faces... " << std::flush;
 
-    // estimate the number of BVH nodes and reserve space
-    {
-        uint32_t numNodes = std::bit_ceil(numFaces / numFacesPerLeaf);
-        numNodes = std::min(numNodes, (1U << maxDepth)) - 1;
+    // pre-compute the bounds and the center of each triangle
+    std::vector<AABB> faceBounds(numFaces);
+    std::vector<Point3D> centroids(numFaces);
+#pragma omp parallel for if (params.parallel)
+    for (OMPIndex i = 0; i < static_cast<OMPIndex>(numFaces); ++i) {
+        const Triangle triangle = mesh.getTriangleFromFaceIndex(static_cast<uint32_t>(i));
+        faceBounds[i].extend(triangle.v1);
+        faceBounds[i].extend(triangle.v2);
+        faceBounds[i].extend(triangle.v3);
+        centroids[i] = (triangle.v1 + triangle.v2 + triangle.v3) * (1.0f / 3.0f);
+    }
 
-        nodes.reserve(numNodes);
-        faceIndices.reserve(numFaces);
+    const float unoptimizedSAHCost =
+        build(mesh.getBounds(), std::move(faceBounds), std::move(centroids), params);
+    storeTriangles(mesh, params.parallel);
+
+    std::cout << "done. (used " << nodes.size() << " BVH nodes";
+    if (params.treeletOptimizationPasses > 0)
+        std::cout << ", treelet optimization changed the SAH cost from " << unoptimizedSAHCost
+                  << " to " << builtSAHCost;
+    std::cout << ")" << std::endl;
+}
+
+void BVH::construct(std::span<const AABB> primitiveBounds, const BuildParameters& params)
+{
+    *this = {}; // clear all previous data
+    buildParameters = params;
+
+    if (primitiveBounds.size() >= leafFlag) {
+        std::cerr << "too many primitives for 31bit indices" << std::endl;
+        return;
+    }
+
+    AABB bounds;
+    std::vector<Point3D> centroids(primitiveBounds.size());
+    for (size_t i = 0; i < primitiveBounds.size(); ++i) {
+        bounds += primitiveBounds[i];
+        centroids[i] = primitiveBounds[i].center();
+    }
+
+    build(bounds, {primitiveBounds.begin(), primitiveBounds.end()}, std::move(centroids), params);
+}
+
+float BVH::build(const AABB& bounds, std::vector<AABB>&& primitiveBounds,
+                 std::vector<Point3D>&& centroids, const BuildParameters& params)
+{
+    const uint32_t numFaces = static_cast<uint32_t>(primitiveBounds.size());
+
+    BuildContext context{params,
+                         params.splitMethod == SplitMethod::SAH && params.numBins >= 2,
+                         std::min(params.numBins, maxNumBins),
+                         std::move(primitiveBounds),
+                         std::move(centroids),
+                         {},
+                         maxDepth - 1};
+
+    // the median split yields a balanced tree, limit its depth as if all leaves were full
+    if (params.splitMethod == SplitMethod::Median) {
+        const uint32_t numLevels =
+            static_cast<uint32_t>(std::bit_width(std::bit_ceil(numFaces / numFacesPerLeaf)));
+        context.maxSplitDepth = std::min(context.maxSplitDepth, std::max(numLevels, 2U) - 2);
     }
 
     // initialize the BVH
-    nodes.push_back(Node{mesh.getBounds(), 0, numFaces});
-    for (uint32_t i = 0; i < numFaces; ++i)
-        faceIndices.push_back(i);
-
-    // compute the center of the triangle behind a given index
-    auto triangleCenter = [&](uint32_t triangleIndex, uint8_t dim) -> float {
-        const Triangle triangle = mesh.getTriangleFromFaceIndex(triangleIndex);
-        return (triangle.v1[dim] + triangle.v2[dim] + triangle.v3[dim]) * (1.0f / 3.0f);
+    faceIndices.resize(numFaces);
+    std::iota(faceIndices.begin(), faceIndices.end(), 0U);
+    std::vector<BuildNode> tree{BuildNode{bounds, 0, numFaces}};
+    tree.reserve(2 * numFaces / numFacesPerLeaf + 1);
+
+    if (params.splitMethod == SplitMethod::Morton) {
+        const AABB centroidBounds = reduceCentroids(faceIndices, context.centroids, params.parallel);
+        const Vector3D invExtents = centroidBounds.extents().inverse();
+
+        context.mortonCodes.resize(numFaces);
+#pragma omp parallel for if (params.parallel)
+        for (OMPIndex i = 0; i < static_cast<OMPIndex>(numFaces); ++i) {
+            Vector3D relative = (context.centroids[i] - centroidBounds.min) * invExtents;
+            // flat meshes have no extent in some dimension
+            for (uint8_t dim = 0; dim < 3; ++dim) {
+                if (!std::isfinite(relative[dim]))
+                    relative[dim] = 0.0f;
+            }
+            context.mortonCodes[i] = mortonCode(relative);
+        }
+
+        radixSort(context.mortonCodes, faceIndices, params.parallel);
+    }
+
+    if (!params.parallel) {
+        constructSubtree(tree, context);
+    }
+    else {
+        // split the top levels breadth-first (with parallel reductions within each node) until
+        // the remaining subtrees are small enough to be built by a single thread
+        std::vector<uint32_t> subtreeRoots;
+        for (size_t i = 0; i < tree.size(); ++i) {
+            if (tree[i].facesEnd - tree[i].facesBegin <= maxFacesPerSubtree) {
+                subtreeRoots.push_back(static_cast<uint32_t>(i));
+                continue;
+            }
+
+            BuildNode left;
+            BuildNode right;
+            if (!splitNode(tree[i], left, right, context, true))
+                continue;
+
+            tree[i].leftChild = static_cast<uint32_t>(tree.size());
+            tree.push_back(left);
+            tree.push_back(right);
+        }
+
+        // the subtrees cover disjoint face indices
+        std::vector<std::vector<BuildNode>> subtrees(subtreeRoots.size());
+#pragma omp parallel for schedule(dynamic)
+        for (OMPIndex k = 0; k < static_cast<OMPIndex>(subtreeRoots.size()); ++k) {
+            subtrees[k] = {tree[subtreeRoots[k]]};
+            constructSubtree(subtrees[k], context);
+        }
+
+        // append the subtrees, the first node of each replaces its root
+        for (size_t k = 0; k < subtrees.size(); ++k) {
+            const uint32_t offset = static_cast<uint32_t>(tree.size()) - 1;
+            for (BuildNode& node : subtrees[k]) {
+                if (node.leftChild)
+                    node.leftChild += offset;
+            }
+            tree[subtreeRoots[k]] = subtrees[k].front();
+            tree.insert(tree.end(), subtrees[k].begin() + 1, subtrees[k].end());
+            subtrees[k] = {};
+        }
+    }
+
+    if (params.splitMethod == SplitMethod::Morton)
+        computeBoundsBottomUp(tree, context, params.parallel);
+
+    const float unoptimizedSAHCost =
+        params.treeletOptimizationPasses > 0 ? optimizeTreelets(tree, params) : 0.0f;
+
+    linearize(tree);
+    wideNodes.clear();
+    if (params.wideNodes)
+        collapse();
+    builtSAHCost = computeSAHCost();
+
+    return unoptimizedSAHCost;
+}
+
+void BVH::refit(const Mesh& mesh)
+{
+    if (nodes.empty() || mesh.getFaces().size() != faceIndices.size()) {
+        const BuildParameters params = buildParameters;
+        construct(mesh, params);
+        return;
+    }
+
+    // leaves first (independent of each other), this also updates the stored triangles
+#pragma omp parallel for if (buildParameters.parallel) schedule(dynamic, 256)
+    for (OMPIndex i = 0; i < static_cast<OMPIndex>(nodes.size()); ++i) {
+        Node& node = nodes[i];
+        if (!node.isLeaf())
+            continue;
+
+        AABB bounds;
+        for (uint32_t k = node.facesBegin(); k < node.facesEnd(); ++k) {
+            const Triangle triangle = mesh.getTriangleFromFaceIndex(faceIndices[k]);
+            triangles[k] = {triangle.v1, triangle.v2, triangle.v3};
+            bounds.extend(triangle.v1);
+            bounds.extend(triangle.v2);
+            bounds.extend(triangle.v3);
+        }
+        node.bounds = bounds;
+    }
+    packTriangles(buildParameters.parallel);
+
+    // children are always stored behind their parent
+    for (size_t i = nodes.size(); i-- > 0;) {
+        Node& node = nodes[i];
+        if (!node.isLeaf())
+            node.bounds = nodes[i + 1].bounds + nodes[node.rightChild()].bounds;
+    }
+
+    if (!wideNodes.empty())
+        collapse();
+
+    // (trees without a cost, e.g. of empty or flat meshes, are never rebuilt, refits are called
+    // every frame and construct() reports the rebuild anyway)
+    if (buildParameters.maxSAHCostIncrease > 0.0f && builtSAHCost > 0.0f
+        && computeSAHCost() > builtSAHCost * buildParameters.maxSAHCostIncrease) {
+        const BuildParameters params = buildParameters;
+        construct(mesh, params);
+    }
+}
+
+float BVH::computeSAHCost() const
+{
+    if (nodes.empty())
+        return 0.0f;
+    const float rootArea = nodes.front().bounds.surfaceArea();
+    if (!(rootArea > 0.0f))
+        return 0.0f;
+
+    // probability of visiting a node is proportional to its surface area
+    double cost = 0.0;
+    for (const Node& node : nodes) {
+        const double area = node.bounds.surfaceArea();
+        if (node.isLeaf())
+            cost += area * (node.facesEnd() - node.facesBegin()) * buildParameters.intersectionCost;
+        else
+            cost += area * buildParameters.traversalCost;
+    }
+    return static_cast<float>(cost / rootArea);
+}
+
+void BVH::computeBoundsBottomUp(std::vector<BuildNode>& tree, const BuildContext& context,
+                                bool parallel)
+{
+    // leaves first (independent of each other), the root keeps the bounds of the mesh
+#pragma omp parallel for if (parallel)
+    for (OMPIndex i = 1; i < static_cast<OMPIndex>(tree.size()); ++i) {
+        BuildNode& node = tree[i];
+        if (!node.leftChild)
+            node.bounds = reduceBounds(node.getFaces(faceIndices), context.faceBounds, false);
+    }
+
+    // children are always stored behind their parent
+    for (size_t i = tree.size() - 1; i > 0; --i) {
+        BuildNode& node = tree[i];
+        if (node.leftChild)
+            node.bounds = tree[node.leftChild].bounds + tree[node.leftChild + 1].bounds;
+    }
+}
+
+/**
+ * @brief Restructures treelets (a node and its descendants down to a few subtrees) into the
+ * topology with minimal SAH cost, see Karras and Aila: "Fast Parallel Construction of
+ * High-Quality Bounding Volume Hierarchies" (2013). Nodes are processed bottom-up, so each
+ * treelet is formed from already optimized subtrees. The nodes of a treelet reuse its slots in
+ * the tree, so the number of nodes stays the same.
+ */
+struct BVH::TreeletOptimizer {
+    /// maximum number of subtrees the root of a treelet is split into
+    static constexpr uint32_t treeletSize{7};
+    static constexpr uint32_t numSubsets{1U << treeletSize};
+
+    /// SAH cost (not normalized), number of faces and height of the subtree below a node
+    struct SubtreeInfo {
+        float cost{0.0f};
+        uint32_t numFaces{0};
+        uint32_t height{0};
+    };
+
+    std::vector<BuildNode>& tree;
+    const BuildParameters& params;
+    /// information about the subtree below each node of the tree
+    std::vector<SubtreeInfo> subtrees;
+
+    /// compute the subtree information of the given node and all of its descendants
+    void computeSubtreeInfo(uint32_t index)
+    {
+        const BuildNode& node = tree[index];
+        if (!node.leftChild) {
+            const uint32_t numFaces = node.facesEnd - node.facesBegin;
+            subtrees[index] = {
+                node.bounds.surfaceArea() * static_cast<float>(numFaces) * params.intersectionCost,
+                numFaces, 0};
+            return;
+        }
+
+        computeSubtreeInfo(node.leftChild);
+        computeSubtreeInfo(node.leftChild + 1);
+        const SubtreeInfo& left = subtrees[node.leftChild];
+        const SubtreeInfo& right = subtrees[node.leftChild + 1];
+        subtrees[index] = {node.bounds.surfaceArea() * params.traversalCost + left.cost + right.cost,
+                           left.numFaces + right.numFaces, std::max(left.height, right.height) + 1};
+    }
+
+    /// optimize the subtree below the given node bottom-up, skipping subtrees with few faces
+    void optimize(uint32_t index, uint32_t depth, uint32_t skipFaces)
+    {
+        const uint32_t leftChild = tree[index].leftChild;
+        if (!leftChild || subtrees[index].numFaces <= skipFaces)
+            return;
+
+        optimize(leftChild, depth + 1, skipFaces);
+        optimize(leftChild + 1, depth + 1, skipFaces);
+        restructure(index, depth);
+    }
+
+    /// replace the treelet below the given node by its optimal topology
+    void restructure(uint32_t root, uint32_t depth)
+    {
+        // form the treelet by repeatedly opening the inner leaf with the largest surface area,
+        // the child slots of all treelet nodes are reused for the new topology
+        std::array<uint32_t, treeletSize> leaves;
+        std::array<uint32_t, treeletSize - 1> slots;
+        uint32_t numLeaves = 0;
+        uint32_t numSlots = 0;
+
+        slots[numSlots++] = tree[root].leftChild;
+        leaves[numLeaves++] = tree[root].leftChild;
+        leaves[numLeaves++] = tree[root].leftChild + 1;
+        while (numLeaves < treeletSize) {
+            uint32_t largest = numLeaves;
+            float largestArea = -1.0f;
+            for (uint32_t k = 0; k < numLeaves; ++k) {
+                const BuildNode& leaf = tree[leaves[k]];
+                if (leaf.leftChild && leaf.bounds.surfaceArea() > largestArea) {
+                    largest = k;
+                    largestArea = leaf.bounds.surfaceArea();
+                }
+            }
+            if (largest == numLeaves)
+                break;
+
+            const uint32_t leftChild = tree[leaves[largest]].leftChild;
+            slots[numSlots++] = leftChild;
+            leaves[largest] = leftChild;
+            leaves[numLeaves++] = leftChild + 1;
+        }
+
+        // with two leaves, there is only one topology
+        if (numLeaves < 3)
+            return;
+
+        // find the optimal partition of each subset of the leaves (dynamic programming)
+        std::array<AABB, numSubsets> bounds;
+        std::array<float, numSubsets> costs;
+        std::array<uint32_t, numSubsets> heights;
+        std::array<uint8_t, numSubsets> partitions;
+        const uint32_t allLeaves = (1U << numLeaves) - 1;
+        for (uint32_t set = 1; set <= allLeaves; ++set) {
+            const uint32_t lowestLeaf = set & (~set + 1);
+            if (set == lowestLeaf) {
+                const uint32_t k = static_cast<uint32_t>(std::countr_zero(set));
+                bounds[set] = tree[leaves[k]].bounds;
+                costs[set] = subtrees[leaves[k]].cost;
+                heights[set] = subtrees[leaves[k]].height;
+                continue;
+            }
+
+            bounds[set] = bounds[lowestLeaf] + bounds[set ^ lowestLeaf];
+            // each partition is visited once (the lowest leaf is always on the same side)
+            float bestCost = infinity;
+            uint32_t bestPartition = lowestLeaf;
+            for (uint32_t part = (set - 1) & set; part != 0; part = (part - 1) & set) {
+                if (!(part & lowestLeaf))
+                    continue;
+                const float cost = costs[part] + costs[set ^ part];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestPartition = part;
+                }
+            }
+            costs[set] = bounds[set].surfaceArea() * params.traversalCost + bestCost;
+            heights[set] = std::max(heights[bestPartition], heights[set ^ bestPartition]) + 1;
+            partitions[set] = static_cast<uint8_t>(bestPartition);
+        }
+
+        // keep the current topology unless the new one is better and does not exceed maxDepth
+        constexpr float minImprovement{1.0e-5f};
+        if (!(costs[allLeaves] < subtrees[root].cost * (1.0f - minImprovement))
+            || depth + heights[allLeaves] >= maxDepth)
+            return;
+
+        std::array<BuildNode, treeletSize> leafNodes;
+        std::array<SubtreeInfo, treeletSize> leafSubtrees;
+        for (uint32_t k = 0; k < numLeaves; ++k) {
+            leafNodes[k] = tree[leaves[k]];
+            leafSubtrees[k] = subtrees[leaves[k]];
+        }
+
+        uint32_t numUsedSlots = 0;
+        const auto emit = [&](const auto& emit, uint32_t set, uint32_t index) -> void {
+            if (std::has_single_bit(set)) {
+                const uint32_t k = static_cast<uint32_t>(std::countr_zero(set));
+                tree[index] = leafNodes[k];
+                subtrees[index] = leafSubtrees[k];
+                return;
+            }
+
+            const uint32_t leftChild = slots[numUsedSlots++];
+            emit(emit, partitions[set], leftChild);
+            emit(emit, set ^ partitions[set], leftChild + 1);
+
+            // the faces of restructured inner nodes are not contiguous anymore
+            BuildNode& node = tree[index];
+            node.bounds = bounds[set];
+            node.facesBegin = 0;
+            node.facesEnd = 0;
+            node.leftChild = leftChild;
+            subtrees[index] = {
+                costs[set],
+                subtrees[leftChild].numFaces + subtrees[leftChild + 1].numFaces,
+                heights[set]};
+        };
+        emit(emit, allLeaves, root);
+    }
+};
+
+float BVH::optimizeTreelets(std::vector<BuildNode>& tree, const BuildParameters& params)
+{
+    TreeletOptimizer optimizer{tree, params, std::vector<TreeletOptimizer::SubtreeInfo>(tree.size())};
+    optimizer.computeSubtreeInfo(0);
+
+    const float rootArea = tree.front().bounds.surfaceArea();
+    const float unoptimizedSAHCost =
+        rootArea > 0.0f ? optimizer.subtrees.front().cost / rootArea : 0.0f;
+
+    struct SubtreeRoot {
+        uint32_t index;
+        uint32_t depth;
+    };
+    for (uint32_t pass = 0; pass < params.treeletOptimizationPasses; ++pass) {
+        // the subtrees with few faces are optimized in parallel, then the nodes above them
+        // (restructuring moves the subtrees, so they are collected again in each pass)
+        std::vector<SubtreeRoot> subtreeRoots;
+        std::vector<SubtreeRoot> stack;
+        if (params.parallel)
+            stack.push_back({0, 0});
+        while (!stack.empty()) {
+            const SubtreeRoot entry = stack.back();
+            stack.pop_back();
+
+            const uint32_t leftChild = tree[entry.index].leftChild;
+            if (optimizer.subtrees[entry.index].numFaces <= maxFacesPerSubtree) {
+                subtreeRoots.push_back(entry);
+            }
+            else if (leftChild) {
+                stack.push_back({leftChild, entry.depth + 1});
+                stack.push_back({leftChild + 1, entry.depth + 1});
+            }
+        }
+
+#pragma omp parallel for schedule(dynamic) if (params.parallel)
+        for (OMPIndex k = 0; k < static_cast<OMPIndex>(subtreeRoots.size()); ++k)
+            optimizer.optimize(subtreeRoots[k].index, subtreeRoots[k].depth, 0);
+
+        optimizer.optimize(0, 0, params.parallel ? maxFacesPerSubtree : 0);
+    }
+
+    return unoptimizedSAHCost;
+}
+
+void BVH::linearize(const std::vector<BuildNode>& tree)
+{
+    nodes.clear();
+    nodes.reserve(tree.size());
+
+    struct StackEntry {
+        /// index into the tree
+        uint32_t treeIndex;
+        /// the node that references this one as its right child
+        uint32_t parent;
     };
+    constexpr uint32_t noParent = std::numeric_limits<uint32_t>::max();
+
+    std::vector<StackEntry> stack{{0, noParent}};
+    while (!stack.empty()) {
+        const StackEntry entry = stack.back();
+        stack.pop_back();
+
+        const uint32_t nodeIndex = static_cast<uint32_t>(nodes.size());
+        if (entry.parent != noParent)
+            nodes[entry.parent].offset = nodeIndex;
+
+        const BuildNode& node = tree[entry.treeIndex];
+        if (node.leftChild) {
+            nodes.push_back({node.bounds, 0, 0});
+            stack.push_back({node.leftChild + 1, nodeIndex});
+            stack.push_back({node.leftChild, noParent});
+        }
+        else {
+            nodes.push_back({node.bounds, node.facesBegin | leafFlag, node.facesEnd});
+        }
+    }
 
-    for (uint32_t i = 0; i < nodes.size() && i < (nodes.capacity() - 1) / 2; ++i) {
-        const Node& currentNode = nodes.at(i);
-        if (getFaceIndices(currentNode).size() <= numFacesPerLeaf)
+    // a subtree is skipped by continuing with the parent's right child or the parent's skip
+    if (!nodes.front().isLeaf())
+        nodes.front().end = static_cast<uint32_t>(nodes.size());
+    for (uint32_t i = 0; i < nodes.size(); ++i) {
+        const Node& node = nodes[i];
+        if (node.isLeaf())
             continue;
+        Node& left = nodes[i + 1];
+        Node& right = nodes[node.rightChild()];
+        if (!left.isLeaf())
+            left.end = node.rightChild();
+        if (!right.isLeaf())
+            right.end = node.skip();
+    }
+}
 
-        const uint8_t splitDim = currentNode.bounds.extents().maxDimension();
-        auto currentFaces = getFaceIndices(currentNode);
+void BVH::storeTriangles(const Mesh& mesh, bool parallel)
+{
+    triangles.resize(faceIndices.size());
+#pragma omp parallel for if (parallel)
+    for (OMPIndex i = 0; i < static_cast<OMPIndex>(faceIndices.size()); ++i) {
+        const Triangle triangle = mesh.getTriangleFromFaceIndex(faceIndices[i]);
+        triangles[i] = {triangle.v1, triangle.v2, triangle.v3};
+    }
+    packTriangles(parallel);
+}
 
-        // median split
-        auto center = currentFaces.begin() + currentFaces.size() / 2;
-        std::nth_element(currentFaces.begin(), center, currentFaces.end(),
-                         [&](uint32_t a, uint32_t b) -> bool {
-                             return triangleCenter(a, splitDim) < triangleCenter(b, splitDim);
-                         });
+void BVH::packTriangles(bool parallel)
+{
+    const size_t numPackets = (triangles.size() + trianglePacketWidth - 1) / trianglePacketWidth;
+    trianglePackets.assign(numPackets, TrianglePacket{});
+#pragma omp parallel for if (parallel)
+    for (OMPIndex i = 0; i < static_cast<OMPIndex>(triangles.size()); ++i) {
+        const LeafTriangle& triangle = triangles[i];
+        const Vector3D v1v2 = triangle.v2 - triangle.v1;
+        const Vector3D v1v3 = triangle.v3 - triangle.v1;
+        TrianglePacket& packet = trianglePackets[i / trianglePacketWidth];
+        const uint32_t k = static_cast<uint32_t>(i) % trianglePacketWidth;
+        packet.v1X[k] = triangle.v1.x;
+        packet.v1Y[k] = triangle.v1.y;
+        packet.v1Z[k] = triangle.v1.z;
+        packet.v1v2X[k] = v1v2.x;
+        packet.v1v2Y[k] = v1v2.y;
+        packet.v1v2Z[k] = v1v2.z;
+        packet.v1v3X[k] = v1v3.x;
+        packet.v1v3Y[k] = v1v3.y;
+        packet.v1v3Z[k] = v1v3.z;
+    }
+}
+
+void BVH::collapse()
+{
+    wideNodes.clear();
+    wideNodes.reserve(nodes.size() / (wideNodeWidth - 1) + 1);
+
+    struct StackEntry {
+        /// index into nodes
+        uint32_t nodeIndex;
+        /// the wide node and slot that reference this node
+        uint32_t parent;
+        uint32_t slot;
+    };
+    constexpr uint32_t noParent = std::numeric_limits<uint32_t>::max();
 
-        Node left;
-        Node right;
+    // a leaf as root is stored as the only child of the wide root node
+    std::vector<StackEntry> stack{{0, noParent, 0}};
+    while (!stack.empty()) {
+        const StackEntry entry = stack.back();
+        stack.pop_back();
 
-        left.facesBegin = currentNode.facesBegin;
-        left.facesEnd = right.facesBegin =
-            currentNode.facesBegin
-            + static_cast<uint32_t>(std::distance(currentFaces.begin(), center));
-        right.facesEnd = currentNode.facesEnd;
+        const uint32_t wideIndex = static_cast<uint32_t>(wideNodes.size());
+        if (entry.parent != noParent)
+            wideNodes[entry.parent].offset[entry.slot] = wideIndex;
 
-        for (uint32_t faceIndex : getFaceIndices(left)) {
-            const Triangle triangle = mesh.getTriangleFromFaceIndex(faceIndex);
-            left.bounds.extend(triangle.v1);
-            left.bounds.extend(triangle.v2);
-            left.bounds.extend(triangle.v3);
+        // replace the inner child with the largest surface area by its children until all slots
+        // are used, this keeps the nodes that are likely to be visited close to the root
+        std::array<uint32_t, wideNodeWidth> children{};
+        uint32_t numChildren = 0;
+        if (nodes[entry.nodeIndex].isLeaf()) {
+            children[numChildren++] = entry.nodeIndex;
         }
-        for (uint32_t faceIndex : getFaceIndices(right)) {
-            const Triangle triangle = mesh.getTriangleFromFaceIndex(faceIndex);
-            right.bounds.extend(triangle.v1);
-            right.bounds.extend(triangle.v2);
-            right.bounds.extend(triangle.v3);
+        else {
+            children[numChildren++] = entry.nodeIndex + 1;
+            children[numChildren++] = nodes[entry.nodeIndex].rightChild();
         }
+        while (numChildren < wideNodeWidth) {
+            uint32_t largest = numChildren;
+            float largestArea = -1.0f;
+            for (uint32_t k = 0; k < numChildren; ++k) {
+                const Node& child = nodes[children[k]];
+                if (!child.isLeaf() && child.bounds.surfaceArea() > largestArea) {
+                    largest = k;
+                    largestArea = child.bounds.surfaceArea();
+                }
+            }
+            if (largest == numChildren)
+                break;
 
-        nodes.resize(2 * i + 1); // in case some nodes were skipped
-        nodes.push_back(left); // this will be at 2*i+1
-        nodes.push_back(right); // this will be at 2*i+2
+            const Node& child = nodes[children[largest]];
+            children[numChildren++] = child.rightChild();
+            children[largest] = children[largest] + 1;
+        }
+
+        WideNode& wideNode = wideNodes.emplace_back();
+        for (uint32_t k = 0; k < wideNodeWidth; ++k) {
+            const AABB bounds = k < numChildren ? nodes[children[k]].bounds : AABB{};
+            wideNode.minX[k] = bounds.min.x;
+            wideNode.minY[k] = bounds.min.y;
+            wideNode.minZ[k] = bounds.min.z;
+            wideNode.maxX[k] = bounds.max.x;
+            wideNode.maxY[k] = bounds.max.y;
+            wideNode.maxZ[k] = bounds.max.z;
+            wideNode.offset[k] = leafFlag;
+            wideNode.end[k] = 0;
+
+            if (k >= numChildren)
+                continue;
+            const Node& child = nodes[children[k]];
+            if (child.isLeaf()) {
+                wideNode.offset[k] = child.offset;
+                wideNode.end[k] = child.facesEnd();
+            }
+            else {
+                stack.push_back({children[k], wideIndex, k});
+            }
+        }
+    }
+}
+
+BVH::Stats BVH::computeStats() const
+{
+    Stats stats;
+    stats.sahCost = computeSAHCost();
+    stats.numNodes = static_cast<uint32_t>(nodes.size());
+    stats.nodeBytes = nodes.size() * sizeof(Node) + wideNodes.size() * sizeof(WideNode);
+    stats.faceBytes = faceIndices.size() * sizeof(uint32_t) + triangles.size() * sizeof(LeafTriangle)
+                    + trianglePackets.size() * sizeof(TrianglePacket);
+
+    // the children of a node follow it, so depths can be propagated in a single pass
+    std::vector<uint32_t> depths(nodes.size());
+    double overlapSum = 0.0;
+    for (uint32_t i = 0; i < nodes.size(); ++i) {
+        const Node& node = nodes[i];
+        if (!(node.bounds.min <= node.bounds.max)
+            || (node.isLeaf() && node.facesBegin() == node.facesEnd()))
+            ++stats.numEmptyNodes;
+
+        if (node.isLeaf()) {
+            const uint32_t numFaces = node.facesEnd() - node.facesBegin();
+            ++stats.numLeaves;
+            if (stats.depthHistogram.size() <= depths[i])
+                stats.depthHistogram.resize(depths[i] + 1);
+            ++stats.depthHistogram[depths[i]];
+            if (stats.leafSizeHistogram.size() <= numFaces)
+                stats.leafSizeHistogram.resize(numFaces + 1);
+            ++stats.leafSizeHistogram[numFaces];
+            continue;
+        }
+
+        const Node& left = nodes[i + 1];
+        const Node& right = nodes[node.rightChild()];
+        depths[i + 1] = depths[node.rightChild()] = depths[i] + 1;
+
+        const float area = node.bounds.surfaceArea();
+        if (area > 0.0f)
+            overlapSum += left.bounds.intersection(right.bounds).surfaceArea() / area;
+    }
+
+    const uint32_t numInnerNodes = stats.numNodes - stats.numLeaves;
+    if (numInnerNodes > 0)
+        stats.averageSiblingOverlap = static_cast<float>(overlapSum / numInnerNodes);
+
+    return stats;
+}
+
+std::ostream& operator<<(std::ostream& os, const BVH::Stats& stats)
+{
+    const auto printHistogram = [&os](const std::vector<uint32_t>& histogram) {
+        os << '[';
+        for (size_t i = 0; i < histogram.size(); ++i)
+            os << (i ? " " : "") << histogram[i];
+        os << ']';
+    };
+
+    os << "BVH[" << stats.numNodes << " nodes, " << stats.numLeaves << " leaves, "
+       << stats.numEmptyNodes << " empty, SAH cost " << stats.sahCost << ", sibling overlap "
+       << stats.averageSiblingOverlap * 100.0f << "%, leaves per depth ";
+    printHistogram(stats.depthHistogram);
+    os << ", leaves per size ";
+    printHistogram(stats.leafSizeHistogram);
+    os << ", " << stats.nodeBytes / 1024 << " KiB nodes, " << stats.faceBytes / 1024
+       << " KiB faces]";
+    return os;
+}
+
+void BVH::write(std::ostream& out) const
+{
+    // field by field, the struct has padding and bools
+    writeBinary(out, static_cast<uint32_t>(buildParameters.splitMethod));
+    writeBinary(out, buildParameters.numBins);
+    writeBinary(out, buildParameters.maxFacesPerLeaf);
+    writeBinary(out, buildParameters.traversalCost);
+    writeBinary(out, buildParameters.intersectionCost);
+    writeBinary(out, static_cast<uint8_t>(buildParameters.parallel));
+    writeBinary(out, static_cast<uint8_t>(buildParameters.wideNodes));
+    writeBinary(out, buildParameters.maxSAHCostIncrease);
+    writeBinary(out, buildParameters.treeletOptimizationPasses);
+    writeBinary(out, builtSAHCost);
+    writeBinary(out, nodes);
+    writeBinary(out, wideNodes);
+    writeBinary(out, faceIndices);
+    writeBinary(out, triangles);
+}
+
+bool BVH::read(BinaryReader& in, size_t numFaces)
+{
+    *this = {};
+    uint32_t splitMethod;
+    uint8_t parallel, wide;
+    if (!in.read(splitMethod) || !in.read(buildParameters.numBins)
+        || !in.read(buildParameters.maxFacesPerLeaf) || !in.read(buildParameters.traversalCost)
+        || !in.read(buildParameters.intersectionCost) || !in.read(parallel) || !in.read(wide)
+        || !in.read(buildParameters.maxSAHCostIncrease)
+        || !in.read(buildParameters.treeletOptimizationPasses) || !in.read(builtSAHCost)
+        || !in.read(nodes) || !in.read(wideNodes) || !in.read(faceIndices)
+        || !in.read(triangles)) {
+        *this = {};
+        return false;
+    }
+    buildParameters.splitMethod = static_cast<SplitMethod>(splitMethod);
+    buildParameters.parallel = parallel;
+    buildParameters.wideNodes = wide;
+
+    // check all references, so a corrupted file cannot cause out of bounds accesses
+    bool valid = splitMethod <= static_cast<uint32_t>(SplitMethod::Morton) && parallel <= 1
+              && wide <= 1;
+    valid = valid && faceIndices.size() == numFaces && triangles.size() == numFaces;
+    for (uint32_t index : faceIndices)
+        valid = valid && index < numFaces;
+    for (uint32_t i = 0; i < nodes.size(); ++i) {
+        const Node& node = nodes[i];
+        if (node.isLeaf())
+            valid = valid && node.facesBegin() <= node.facesEnd() && node.facesEnd() <= numFaces;
+        else
+            valid = valid && node.rightChild() > i + 1 && node.rightChild() < node.skip()
+                 && node.skip() <= nodes.size();
+    }
+    // wide nodes are stored in depth-first order as well, their depth bounds the traversal stack
+    std::vector<uint32_t> wideDepths(wideNodes.size());
+    for (uint32_t i = 0; valid && i < wideNodes.size(); ++i) {
+        const WideNode& node = wideNodes[i];
+        for (uint32_t k = 0; k < wideNodeWidth; ++k) {
+            if (node.isLeaf(k)) {
+                valid = valid && node.facesBegin(k) <= node.facesEnd(k)
+                     && node.facesEnd(k) <= numFaces;
+            }
+            else {
+                valid = valid && node.offset[k] > i && node.offset[k] < wideNodes.size()
+                     && wideDepths[i] + 1 < maxDepth;
+                if (valid)
+                    wideDepths[node.offset[k]] =
+                        std::max(wideDepths[node.offset[k]], wideDepths[i] + 1);
+            }
+        }
     }
 
-    std::cout << "done. (used " << nodes.size() << " BVH nodes)" << std::endl;
+    if (!valid)
+        *this = {};
+    else
+        packTriangles(buildParameters.parallel);
+    return valid;
 }
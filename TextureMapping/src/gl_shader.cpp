@@ -4,7 +4,9 @@
 
 #include <render/scene.h>
 
+#include <algorithm>
 #include <fstream>
+#include <numeric>
 #include <sstream>
 #include <string>
 
@@ -250,10 +252,35 @@ BVHShader::BVHShader(const Instance& instance)
     const BVH& bvh = mesh.getBVH();
     const auto& bvhNodes = bvh.getNodes();
     numBVHNodes = bvhNodes.size();
+
+    // the nodes are stored depth-first, sort them by depth to draw the top levels only
+    std::vector<uint32_t> nodesByDepth(numBVHNodes);
+    {
+        std::vector<uint32_t> depths(numBVHNodes);
+        for (uint32_t i = 0; i < numBVHNodes; ++i) {
+            if (!bvhNodes[i].isLeaf()) {
+                depths[i + 1] = depths[i] + 1;
+                depths[bvhNodes[i].rightChild()] = depths[i] + 1;
+            }
+        }
+
+        std::iota(nodesByDepth.begin(), nodesByDepth.end(), 0U);
+        std::stable_sort(nodesByDepth.begin(), nodesByDepth.end(),
+                         [&](uint32_t a, uint32_t b) { return depths[a] < depths[b]; });
+
+        numBVHNodesAboveLevel.clear();
+        for (uint32_t i = 0; i < numBVHNodes; ++i) {
+            if (depths[nodesByDepth[i]] >= numBVHNodesAboveLevel.size())
+                numBVHNodesAboveLevel.push_back(i);
+        }
+        numBVHNodesAboveLevel.push_back(numBVHNodes);
+    }
+
     {
         std::vector<Point3D> bvhVertices;
         bvhVertices.reserve(numBVHNodes * 8);
-        for (auto& node : bvhNodes) {
+        for (uint32_t nodeIndex : nodesByDepth) {
+            const BVH::Node& node = bvhNodes[nodeIndex];
             bvhVertices.emplace_back(node.bounds.min.x, node.bounds.min.y, node.bounds.min.z);
             bvhVertices.emplace_back(node.bounds.min.x, node.bounds.min.y, node.bounds.max.z);
             bvhVertices.emplace_back(node.bounds.min.x, node.bounds.max.y, node.bounds.min.z);
@@ -303,7 +330,7 @@ void BVHShader::draw(uint32_t bvhLevel, const Matrix4D& vp)
     bvhShader.setUniform("mvp", vp * model);
 
     const size_t displayBVHNodes =
-        std::min(numBVHNodes, static_cast<size_t>(1UL << bvhLevel) - 1UL);
+        numBVHNodesAboveLevel.at(std::min<size_t>(bvhLevel, numBVHNodesAboveLevel.size() - 1));
     vertexBuffer.draw("lines", GL_LINES, 0, displayBVHNodes * 12);
 
     bvhShader.deactivate();
@@ -337,7 +364,14 @@ MeshShader::MeshShader(const Instance& instance)
         vertexBuffer.setBuffer<Point2D>("texCoords", mesh.getTextureCoordinates());
 
     numTriangles = mesh.getFaces().size();
-    smoothGroups = mesh.getSmoothGroups();
+    for (uint32_t from = 0; from < numTriangles;) {
+        const bool smooth = mesh.isSmoothFace(from);
+        uint32_t to = from + 1;
+        while (to < numTriangles && mesh.isSmoothFace(to) == smooth)
+            ++to;
+        (smooth ? smoothRanges : flatRanges).emplace_back(from, to);
+        from = to;
+    }
 
     if (instance.material.textures.displacement) {
         meshShader = {readShaderFile("../src/shaders/exercise07.vert"),
@@ -456,19 +490,14 @@ void MeshShader::draw(const Light::Point& light, const Point3D cameraPos, const
     // draw flat parts
     {
         meshShader.setUniform("shadeFlat", true);
-        size_t pos = 0;
-        for (auto [start, end] : smoothGroups) {
-            if (start > pos)
-                vertexBuffer.draw("triangles", mode, pos, start);
-            pos = end;
-        }
-        vertexBuffer.draw("triangles", mode, pos, numTriangles);
+        for (auto [from, to] : flatRanges)
+            vertexBuffer.draw("triangles", mode, from, to);
     }
     // draw smooth parts
     {
         meshShader.setUniform("shadeFlat", false);
-        for (auto [start, end] : smoothGroups)
-            vertexBuffer.draw("triangles", mode, start, end);
+        for (auto [from, to] : smoothRanges)
+            vertexBuffer.draw("triangles", mode, from, to);
     }
 
     meshShader.deactivate();
@@ -487,19 +516,14 @@ void MeshShader::drawWobble(const Light::Point& light, const Matrix4D& vp, float
     // draw flat parts
     {
         wobbleShader.setUniform("shadeFlat", true);
-        size_t pos = 0;
-        for (auto [start, end] : smoothGroups) {
-            if (start > pos)
-                vertexBuffer.draw("triangles", GL_TRIANGLES, pos, start);
-            pos = end;
-        }
-        vertexBuffer.draw("triangles", GL_TRIANGLES, pos, numTriangles);
+        for (auto [from, to] : flatRanges)
+            vertexBuffer.draw("triangles", GL_TRIANGLES, from, to);
     }
     // draw smooth parts
     {
         wobbleShader.setUniform("shadeFlat", false);
-        for (auto [start, end] : smoothGroups)
-            vertexBuffer.draw("triangles", GL_TRIANGLES, start, end);
+        for (auto [from, to] : smoothRanges)
+            vertexBuffer.draw("triangles", GL_TRIANGLES, from, to);
     }
 
     wobbleShader.deactivate();
@@ -535,19 +559,14 @@ void MeshShader::drawDebug(const AABB& bounds, const Point3D& cameraPos, RenderM
     // draw flat parts
     {
         debugShader.setUniform("shadeFlat", true);
-        size_t pos = 0;
-        for (auto [start, end] : smoothGroups) {
-            if (start > pos)
-                vertexBuffer.draw("triangles", GL_TRIANGLES, pos, start);
-            pos = end;
-        }
-        vertexBuffer.draw("triangles", GL_TRIANGLES, pos, numTriangles);
+        for (auto [from, to] : flatRanges)
+            vertexBuffer.draw("triangles", GL_TRIANGLES, from, to);
     }
     // draw smooth parts
     {
         debugShader.setUniform("shadeFlat", false);
-        for (auto [start, end] : smoothGroups)
-            vertexBuffer.draw("triangles", GL_TRIANGLES, start, end);
+        for (auto [from, to] : smoothRanges)
+            vertexBuffer.draw("triangles", GL_TRIANGLES, from, to);
     }
 
     debugShader.deactivate();
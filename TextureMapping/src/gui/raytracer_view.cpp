@@ -1,6 +1,7 @@
 #include <gui/raytracer_view.h>
 
 #include <string>
+#include <vector>
 
 using namespace std::literals::string_literals;
 
@@ -82,8 +83,13 @@ RayTracerView::RayTracerView(nanogui::Widget* parent, Toolbar* toolbar, RayTrace
     new Label(rayTracerControls, "Ray Tracer");
     (new Widget(rayTracerControls))->set_fixed_width(16); // spacer
 
-    auto renderMode =
-        new ComboBox(rayTracerControls, {"Depth", "Position", "Normal", "Whitted", "Path"});
+    std::vector<std::string> renderModes{"Depth", "Position", "Normal",
+                                         "Whitted", "Path", "Wavefront"};
+#ifdef TRAVERSAL_STATISTICS
+    // without the counters, the traversal cost would always be zero
+    renderModes.push_back("Traversal Cost");
+#endif
+    auto renderMode = new ComboBox(rayTracerControls, renderModes);
     renderMode->set_callback(
         [&](int i) -> void { params.mode = RayTracerParameters::RenderMode{i}; });
     renderMode->set_selected_index(static_cast<int>(params.mode));
@@ -110,6 +116,10 @@ RayTracerView::RayTracerView(nanogui::Widget* parent, Toolbar* toolbar, RayTrace
     spp->set_spinnable(true);
     spp->set_min_value(1);
 
+    (new CheckBox(rayTracerControls, "sort rays", [&](bool b) -> void {
+        params.sortSecondaryRays = b;
+    }))->set_checked(params.sortSecondaryRays);
+
     progress = new ProgressBar(rayTracerControls);
 
     auto resetView = new Button(rayTracerControls, "Reset View", FA_VECTOR_SQUARE);
@@ -144,13 +154,23 @@ void RayTracerView::draw(NVGcontext* context)
         texture->upload(reinterpret_cast<const uint8_t*>(pixels.data()));
 
         progress->set_value(sppRendered / params.maxSPP);
-        progress->set_tooltip(std::to_string(static_cast<uint32_t>(sppRendered)) + " / "s
-                              + std::to_string(params.maxSPP));
+        std::string tooltip = std::to_string(static_cast<uint32_t>(sppRendered)) + " / "s
+                            + std::to_string(params.maxSPP);
+#ifdef TRAVERSAL_STATISTICS
+        const TraversalCounters counters = rayTracer.getFrameCounters();
+        tooltip += "\nper sample: "s + std::to_string(counters.nodesVisited) + " nodes, "s
+                 + std::to_string(counters.boxTests) + " boxes, "s
+                 + std::to_string(counters.triangleTests) + " triangles, "s
+                 + std::to_string(counters.shadowRays) + " shadow rays"s;
+#endif
+        progress->set_tooltip(tooltip);
         m_image_shader->set_uniform("blur",
                                     5.0f * std::exp(-sppRendered * (1.0f / std::log(5.0f))));
         m_image_shader->set_uniform("useSRGB",
                                     params.mode == RayTracerParameters::RenderMode::Whitted
-                                        || params.mode == RayTracerParameters::RenderMode::Path);
+                                        || params.mode == RayTracerParameters::RenderMode::Path
+                                        || params.mode
+                                               == RayTracerParameters::RenderMode::Wavefront);
     }
     ImageView::draw(context);
 
@@ -5,119 +5,910 @@
 #include <render/ray.h>
 #include <render/scene.h>
 
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <cmath>
+#include <limits>
+#include <span>
+
+#if defined(__AVX__) || defined(__SSE__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+namespace {
+/// enlarge the intervals of the slab tests slightly to account for rounding errors
+constexpr float tFarScale{1.0f + 4.0f * std::numeric_limits<float>::epsilon()};
+
+// thin wrappers, so the wide slab test can be written once for all vector widths
+#if defined(__AVX__)
+#define WIDE_SLAB_TEST
+static_assert(BVH::wideNodeWidth == 8);
+using SIMDFloat = __m256;
+inline SIMDFloat load(const float* p) { return _mm256_load_ps(p); }
+inline void store(float* p, SIMDFloat a) { _mm256_store_ps(p, a); }
+inline SIMDFloat broadcast(float x) { return _mm256_set1_ps(x); }
+inline SIMDFloat sub(SIMDFloat a, SIMDFloat b) { return _mm256_sub_ps(a, b); }
+inline SIMDFloat mul(SIMDFloat a, SIMDFloat b) { return _mm256_mul_ps(a, b); }
+inline SIMDFloat min(SIMDFloat a, SIMDFloat b) { return _mm256_min_ps(a, b); }
+inline SIMDFloat max(SIMDFloat a, SIMDFloat b) { return _mm256_max_ps(a, b); }
+inline uint32_t lessEqual(SIMDFloat a, SIMDFloat b)
+{
+    return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_LE_OQ)));
+}
+#elif defined(__SSE__) || defined(_M_X64)
+#define WIDE_SLAB_TEST
+static_assert(BVH::wideNodeWidth == 4);
+using SIMDFloat = __m128;
+inline SIMDFloat load(const float* p) { return _mm_load_ps(p); }
+inline void store(float* p, SIMDFloat a) { _mm_store_ps(p, a); }
+inline SIMDFloat broadcast(float x) { return _mm_set1_ps(x); }
+inline SIMDFloat sub(SIMDFloat a, SIMDFloat b) { return _mm_sub_ps(a, b); }
+inline SIMDFloat mul(SIMDFloat a, SIMDFloat b) { return _mm_mul_ps(a, b); }
+inline SIMDFloat min(SIMDFloat a, SIMDFloat b) { return _mm_min_ps(a, b); }
+inline SIMDFloat max(SIMDFloat a, SIMDFloat b) { return _mm_max_ps(a, b); }
+inline uint32_t lessEqual(SIMDFloat a, SIMDFloat b)
+{
+    return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(a, b)));
+}
+#endif
+} // namespace
+
+TraversalCounters& TraversalCounters::thisThread()
+{
+    static thread_local TraversalCounters counters;
+    return counters;
+}
 
 bool Intersection::intersect(const AABB& aabb, const IntersectionRay& ray)
+{
+    float tNear;
+    return intersect(aabb, ray, tNear);
+}
+
+bool Intersection::intersect(const AABB& aabb, const IntersectionRay& ray, float& tNear)
 {
     const Point3D t1 = (aabb.min - ray.origin) * ray.inv_direction;
     const Point3D t2 = (aabb.max - ray.origin) * ray.inv_direction;
 
-    const float tNear = ::min(t1, t2).maxComponent();
-    const float tFar = ::max(t1, t2).minComponent();
+    tNear = ::min(t1, t2).maxComponent();
+    // enlarge the interval slightly to account for rounding errors (flat boxes are common)
+    const float tFar = ::max(t1, t2).minComponent() * tFarScale;
 
     return tNear <= tFar && tNear <= ray.tMax && tFar >= ray.tMin;
 }
 
-Intersection::Intersection(const Triangle& triangle, const IntersectionRay& ray)
+uint32_t Intersection::intersect(const BVH::WideNode& node, const IntersectionRay& ray,
+                                 float* tNear)
 {
-    Normal3D normal = cross(triangle.v1v2, triangle.v1v3);
-    distance = dot(triangle.v1 - ray.origin, normal) / dot(ray.direction, normal);
+#ifdef WIDE_SLAB_TEST
+    // select the near and far planes by the sign of the direction instead of sorting the
+    // distances, this also rejects the inverted bounds of unused slots
+    const bool positiveX = ray.inv_direction.x >= 0.0f;
+    const bool positiveY = ray.inv_direction.y >= 0.0f;
+    const bool positiveZ = ray.inv_direction.z >= 0.0f;
 
-    if (distance < ray.tMin || distance > ray.tMax) {
-        distance = infinity;
-        return;
+    const SIMDFloat originX = broadcast(ray.origin.x);
+    const SIMDFloat originY = broadcast(ray.origin.y);
+    const SIMDFloat originZ = broadcast(ray.origin.z);
+    const SIMDFloat invDirX = broadcast(ray.inv_direction.x);
+    const SIMDFloat invDirY = broadcast(ray.inv_direction.y);
+    const SIMDFloat invDirZ = broadcast(ray.inv_direction.z);
+
+    const SIMDFloat tNearX = mul(sub(load(positiveX ? node.minX : node.maxX), originX), invDirX);
+    const SIMDFloat tNearY = mul(sub(load(positiveY ? node.minY : node.maxY), originY), invDirY);
+    const SIMDFloat tNearZ = mul(sub(load(positiveZ ? node.minZ : node.maxZ), originZ), invDirZ);
+    const SIMDFloat tFarX = mul(sub(load(positiveX ? node.maxX : node.minX), originX), invDirX);
+    const SIMDFloat tFarY = mul(sub(load(positiveY ? node.maxY : node.minY), originY), invDirY);
+    const SIMDFloat tFarZ = mul(sub(load(positiveZ ? node.maxZ : node.minZ), originZ), invDirZ);
+
+    const SIMDFloat entry = max(max(tNearX, tNearY), max(tNearZ, broadcast(ray.tMin)));
+    const SIMDFloat exit = mul(min(min(tFarX, tFarY), tFarZ), broadcast(tFarScale));
+    store(tNear, entry);
+
+    return lessEqual(entry, min(exit, broadcast(ray.tMax)));
+#else
+    uint32_t hits = 0;
+    for (uint32_t k = 0; k < BVH::wideNodeWidth; ++k) {
+        const AABB bounds{{node.minX[k], node.minY[k], node.minZ[k]},
+                          {node.maxX[k], node.maxY[k], node.maxZ[k]}};
+        if (intersect(bounds, ray, tNear[k]))
+            hits |= 1U << k;
+        tNear[k] = std::max(tNear[k], ray.tMin);
     }
+    return hits;
+#endif
+}
 
-    Point3D point = ray.origin + ray.direction * distance;
-    const Vector3D v1p = point - triangle.v1;
-
-    /* Compute triangle areas corresponding to barycentric coordinates.
-     * The ray is outside if any coordinate is negative
-     * or the sum of two coordinates is larger than triangle area.
-     * (Then, the third coordinate would be negative.)
-     */
-    const Vector3D bary2 = cross(v1p, triangle.v1v3);
-    if (dot(bary2, normal) < 0.0f) {
-        distance = infinity;
-        return;
+#ifdef WATERTIGHT_INTERSECTION
+Intersection::Intersection(const BVH::LeafTriangle& triangle, const IntersectionRay& ray)
+{
+    // watertight test by Woop et al.: transform the vertices into the space of the ray, where the
+    // ray hits the triangle if the origin lies inside its 2D projection
+    const Point3D a = ray.shear(triangle.v1 - ray.origin);
+    const Point3D b = ray.shear(triangle.v2 - ray.origin);
+    const Point3D c = ray.shear(triangle.v3 - ray.origin);
+
+    // scaled barycentric coordinates (edge functions), neighboring triangles compute the same
+    // value for their shared edge, so a ray cannot pass between them
+    float u = c.x * b.y - c.y * b.x;
+    float v = a.x * c.y - a.y * c.x;
+    float w = b.x * a.y - b.y * a.x;
+    // recompute with double precision if the ray hits an edge
+    if (u == 0.0f || v == 0.0f || w == 0.0f) {
+        u = static_cast<float>(static_cast<double>(c.x) * b.y - static_cast<double>(c.y) * b.x);
+        v = static_cast<float>(static_cast<double>(a.x) * c.y - static_cast<double>(a.y) * c.x);
+        w = static_cast<float>(static_cast<double>(b.x) * a.y - static_cast<double>(b.y) * a.x);
     }
-    const Vector3D bary3 = cross(triangle.v1v2, v1p);
-    if (dot(bary3, normal) < 0.0f) {
-        distance = infinity;
+    if ((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f))
+        return;
+
+    const float det = u + v + w;
+    if (det == 0.0f)
+        return;
+
+    // defer the division until the hit is accepted
+    const float t = (u * a.z + v * b.z + w * c.z) / det;
+    if (!(t >= ray.tMin && t <= ray.tMax))
+        return;
+
+    distance = t;
+    bary.lambda2 = v / det;
+    bary.lambda3 = w / det;
+}
+#else
+Intersection::Intersection(const BVH::LeafTriangle& triangle, const IntersectionRay& ray)
+{
+    // Moeller-Trumbore test: solve for the distance and the barycentric coordinates directly,
+    // rejecting the ray as soon as one coordinate is outside (no square roots needed)
+    const Vector3D v1v2 = triangle.v2 - triangle.v1;
+    const Vector3D v1v3 = triangle.v3 - triangle.v1;
+    const Vector3D p = cross(ray.direction, v1v3);
+    const float det = dot(v1v2, p);
+    // the ray is parallel to the triangle (or the triangle is degenerate)
+    if (det == 0.0f)
         return;
-    }
 
-    const float invNorm = 1.0f / normal.norm();
-    bary.lambda2 = bary2.norm() * invNorm;
-    bary.lambda3 = bary3.norm() * invNorm;
-    if (bary.lambda1() < 0.0f) {
-        distance = infinity;
+    const float invDet = 1.0f / det;
+    const Vector3D v1o = ray.origin - triangle.v1;
+    const float lambda2 = dot(v1o, p) * invDet;
+    if (lambda2 < 0.0f || lambda2 > 1.0f)
         return;
+
+    const Vector3D q = cross(v1o, v1v2);
+    const float lambda3 = dot(ray.direction, q) * invDet;
+    if (lambda3 < 0.0f || lambda2 + lambda3 > 1.0f)
+        return;
+
+    const float t = dot(v1v3, q) * invDet;
+    if (!(t >= ray.tMin && t <= ray.tMax))
+        return;
+
+    distance = t;
+    bary.lambda2 = lambda2;
+    bary.lambda3 = lambda3;
+}
+#endif
+
+#if (defined(__x86_64__) || defined(_M_X64)) && !defined(WATERTIGHT_INTERSECTION)
+// test whole triangle packets with the Moeller-Trumbore test (the same arithmetic as the scalar
+// test, so both find exactly the same hits), the vector width is chosen at runtime
+#define SIMD_LEAF_TEST
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define TARGET_AVX
+#else
+#define TARGET_AVX __attribute__((target("avx")))
+#endif
+
+namespace {
+/// closest hit of a ray with the selected triangles of a packet
+struct PacketHit {
+    float distance{infinity};
+    BarycentricCoordinates bary;
+    /// slot of the triangle in the packet
+    uint32_t index{0};
+};
+
+/// intersect the triangles in the slots [begin, end) of the packet, returns false if all are missed
+using IntersectPacket = bool (*)(const BVH::TrianglePacket& packet, uint32_t begin, uint32_t end,
+                                 const IntersectionRay& ray, PacketHit& hit);
+
+/// test the slots [begin, end) of the four triangles of the packet starting at the given slot
+bool intersectHalfPacketSSE(const BVH::TrianglePacket& packet, uint32_t first, uint32_t begin,
+                            uint32_t end, const IntersectionRay& ray, PacketHit& hit)
+{
+    const __m128 dirX = _mm_set1_ps(ray.direction.x);
+    const __m128 dirY = _mm_set1_ps(ray.direction.y);
+    const __m128 dirZ = _mm_set1_ps(ray.direction.z);
+    const __m128 v1v2X = _mm_load_ps(packet.v1v2X + first);
+    const __m128 v1v2Y = _mm_load_ps(packet.v1v2Y + first);
+    const __m128 v1v2Z = _mm_load_ps(packet.v1v2Z + first);
+    const __m128 v1v3X = _mm_load_ps(packet.v1v3X + first);
+    const __m128 v1v3Y = _mm_load_ps(packet.v1v3Y + first);
+    const __m128 v1v3Z = _mm_load_ps(packet.v1v3Z + first);
+
+    // p = cross(direction, v1v3)
+    const __m128 pX = _mm_sub_ps(_mm_mul_ps(dirY, v1v3Z), _mm_mul_ps(dirZ, v1v3Y));
+    const __m128 pY = _mm_sub_ps(_mm_mul_ps(dirZ, v1v3X), _mm_mul_ps(dirX, v1v3Z));
+    const __m128 pZ = _mm_sub_ps(_mm_mul_ps(dirX, v1v3Y), _mm_mul_ps(dirY, v1v3X));
+    const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(v1v2X, pX), _mm_mul_ps(v1v2Y, pY)),
+                                  _mm_mul_ps(v1v2Z, pZ));
+    const __m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+    const __m128 v1oX = _mm_sub_ps(_mm_set1_ps(ray.origin.x), _mm_load_ps(packet.v1X + first));
+    const __m128 v1oY = _mm_sub_ps(_mm_set1_ps(ray.origin.y), _mm_load_ps(packet.v1Y + first));
+    const __m128 v1oZ = _mm_sub_ps(_mm_set1_ps(ray.origin.z), _mm_load_ps(packet.v1Z + first));
+    const __m128 lambda2 = _mm_mul_ps(
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(v1oX, pX), _mm_mul_ps(v1oY, pY)), _mm_mul_ps(v1oZ, pZ)),
+        invDet);
+
+    // q = cross(v1o, v1v2)
+    const __m128 qX = _mm_sub_ps(_mm_mul_ps(v1oY, v1v2Z), _mm_mul_ps(v1oZ, v1v2Y));
+    const __m128 qY = _mm_sub_ps(_mm_mul_ps(v1oZ, v1v2X), _mm_mul_ps(v1oX, v1v2Z));
+    const __m128 qZ = _mm_sub_ps(_mm_mul_ps(v1oX, v1v2Y), _mm_mul_ps(v1oY, v1v2X));
+    const __m128 lambda3 = _mm_mul_ps(
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(dirX, qX), _mm_mul_ps(dirY, qY)), _mm_mul_ps(dirZ, qZ)),
+        invDet);
+    const __m128 t = _mm_mul_ps(
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(v1v3X, qX), _mm_mul_ps(v1v3Y, qY)), _mm_mul_ps(v1v3Z, qZ)),
+        invDet);
+
+    // the other slots may belong to other leaves
+    const __m128 slots = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+    const __m128 selected =
+        _mm_and_ps(_mm_cmpge_ps(slots, _mm_set1_ps(static_cast<float>(begin))),
+                   _mm_cmplt_ps(slots, _mm_set1_ps(static_cast<float>(end))));
+
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    __m128 valid = _mm_and_ps(selected, _mm_cmpneq_ps(det, zero));
+    valid = _mm_and_ps(valid, _mm_cmpge_ps(lambda2, zero));
+    valid = _mm_and_ps(valid, _mm_cmple_ps(lambda2, one));
+    valid = _mm_and_ps(valid, _mm_cmpge_ps(lambda3, zero));
+    valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(lambda2, lambda3), one));
+    valid = _mm_and_ps(valid, _mm_cmpge_ps(t, _mm_set1_ps(ray.tMin)));
+    valid = _mm_and_ps(valid, _mm_cmple_ps(t, _mm_set1_ps(ray.tMax)));
+    const uint32_t hits = static_cast<uint32_t>(_mm_movemask_ps(valid));
+    if (hits == 0)
+        return false;
+
+    // horizontal minimum of the hit distances, ties are resolved by the first slot
+    const __m128 distances =
+        _mm_or_ps(_mm_and_ps(valid, t), _mm_andnot_ps(valid, _mm_set1_ps(infinity)));
+    __m128 closest = _mm_min_ps(distances, _mm_shuffle_ps(distances, distances, 0b01001110));
+    closest = _mm_min_ps(closest, _mm_shuffle_ps(closest, closest, 0b10110001));
+    const uint32_t slot = static_cast<uint32_t>(
+        std::countr_zero(static_cast<uint32_t>(_mm_movemask_ps(_mm_cmpeq_ps(distances, closest))) & hits));
+
+    alignas(16) std::array<float, 4> values;
+    _mm_store_ps(values.data(), t);
+    hit.distance = values[slot];
+    _mm_store_ps(values.data(), lambda2);
+    hit.bary.lambda2 = values[slot];
+    _mm_store_ps(values.data(), lambda3);
+    hit.bary.lambda3 = values[slot];
+    hit.index = first + slot;
+    return true;
+}
+
+bool intersectPacketSSE(const BVH::TrianglePacket& packet, uint32_t begin, uint32_t end,
+                        const IntersectionRay& ray, PacketHit& hit)
+{
+    static_assert(BVH::trianglePacketWidth == 8);
+    // the first half wins ties, just like testing the triangles one by one
+    PacketHit secondHit;
+    const bool firstHalf =
+        begin < 4 && intersectHalfPacketSSE(packet, 0, begin, std::min(end, 4U), ray, hit);
+    const bool secondHalf =
+        end > 4
+        && intersectHalfPacketSSE(packet, 4, std::max(begin, 4U) - 4, end - 4, ray, secondHit);
+    if (secondHalf && (!firstHalf || secondHit.distance < hit.distance))
+        hit = secondHit;
+    return firstHalf || secondHalf;
+}
+
+TARGET_AVX bool intersectPacketAVX(const BVH::TrianglePacket& packet, uint32_t begin,
+                                   uint32_t end, const IntersectionRay& ray, PacketHit& hit)
+{
+    const __m256 dirX = _mm256_set1_ps(ray.direction.x);
+    const __m256 dirY = _mm256_set1_ps(ray.direction.y);
+    const __m256 dirZ = _mm256_set1_ps(ray.direction.z);
+    const __m256 v1v2X = _mm256_load_ps(packet.v1v2X);
+    const __m256 v1v2Y = _mm256_load_ps(packet.v1v2Y);
+    const __m256 v1v2Z = _mm256_load_ps(packet.v1v2Z);
+    const __m256 v1v3X = _mm256_load_ps(packet.v1v3X);
+    const __m256 v1v3Y = _mm256_load_ps(packet.v1v3Y);
+    const __m256 v1v3Z = _mm256_load_ps(packet.v1v3Z);
+
+    // p = cross(direction, v1v3)
+    const __m256 pX = _mm256_sub_ps(_mm256_mul_ps(dirY, v1v3Z), _mm256_mul_ps(dirZ, v1v3Y));
+    const __m256 pY = _mm256_sub_ps(_mm256_mul_ps(dirZ, v1v3X), _mm256_mul_ps(dirX, v1v3Z));
+    const __m256 pZ = _mm256_sub_ps(_mm256_mul_ps(dirX, v1v3Y), _mm256_mul_ps(dirY, v1v3X));
+    const __m256 det = _mm256_add_ps(
+        _mm256_add_ps(_mm256_mul_ps(v1v2X, pX), _mm256_mul_ps(v1v2Y, pY)), _mm256_mul_ps(v1v2Z, pZ));
+    const __m256 invDet = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+
+    const __m256 v1oX = _mm256_sub_ps(_mm256_set1_ps(ray.origin.x), _mm256_load_ps(packet.v1X));
+    const __m256 v1oY = _mm256_sub_ps(_mm256_set1_ps(ray.origin.y), _mm256_load_ps(packet.v1Y));
+    const __m256 v1oZ = _mm256_sub_ps(_mm256_set1_ps(ray.origin.z), _mm256_load_ps(packet.v1Z));
+    const __m256 lambda2 = _mm256_mul_ps(
+        _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(v1oX, pX), _mm256_mul_ps(v1oY, pY)),
+                      _mm256_mul_ps(v1oZ, pZ)),
+        invDet);
+
+    // q = cross(v1o, v1v2)
+    const __m256 qX = _mm256_sub_ps(_mm256_mul_ps(v1oY, v1v2Z), _mm256_mul_ps(v1oZ, v1v2Y));
+    const __m256 qY = _mm256_sub_ps(_mm256_mul_ps(v1oZ, v1v2X), _mm256_mul_ps(v1oX, v1v2Z));
+    const __m256 qZ = _mm256_sub_ps(_mm256_mul_ps(v1oX, v1v2Y), _mm256_mul_ps(v1oY, v1v2X));
+    const __m256 lambda3 = _mm256_mul_ps(
+        _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dirX, qX), _mm256_mul_ps(dirY, qY)),
+                      _mm256_mul_ps(dirZ, qZ)),
+        invDet);
+    const __m256 t = _mm256_mul_ps(
+        _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(v1v3X, qX), _mm256_mul_ps(v1v3Y, qY)),
+                      _mm256_mul_ps(v1v3Z, qZ)),
+        invDet);
+
+    // the other slots may belong to other leaves
+    const __m256 slots = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+    const __m256 selected = _mm256_and_ps(
+        _mm256_cmp_ps(slots, _mm256_set1_ps(static_cast<float>(begin)), _CMP_GE_OQ),
+        _mm256_cmp_ps(slots, _mm256_set1_ps(static_cast<float>(end)), _CMP_LT_OQ));
+
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    __m256 valid = _mm256_and_ps(selected, _mm256_cmp_ps(det, zero, _CMP_NEQ_UQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(lambda2, zero, _CMP_GE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(lambda2, one, _CMP_LE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(lambda3, zero, _CMP_GE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(_mm256_add_ps(lambda2, lambda3), one, _CMP_LE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, _mm256_set1_ps(ray.tMin), _CMP_GE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, _mm256_set1_ps(ray.tMax), _CMP_LE_OQ));
+    const uint32_t hits = static_cast<uint32_t>(_mm256_movemask_ps(valid));
+    if (hits == 0)
+        return false;
+
+    // horizontal minimum of the hit distances, ties are resolved by the first slot
+    const __m256 distances = _mm256_blendv_ps(_mm256_set1_ps(infinity), t, valid);
+    __m256 closest = _mm256_min_ps(distances, _mm256_permute2f128_ps(distances, distances, 1));
+    closest = _mm256_min_ps(closest, _mm256_permute_ps(closest, 0b01001110));
+    closest = _mm256_min_ps(closest, _mm256_permute_ps(closest, 0b10110001));
+    const uint32_t slot = static_cast<uint32_t>(std::countr_zero(
+        static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(distances, closest, _CMP_EQ_OQ)))
+        & hits));
+
+    alignas(32) std::array<float, 8> values;
+    _mm256_store_ps(values.data(), t);
+    hit.distance = values[slot];
+    _mm256_store_ps(values.data(), lambda2);
+    hit.bary.lambda2 = values[slot];
+    _mm256_store_ps(values.data(), lambda3);
+    hit.bary.lambda3 = values[slot];
+    hit.index = slot;
+    return true;
+}
+
+/// returns whether the CPU and the operating system support AVX
+bool supportsAVX()
+{
+#if defined(__AVX__)
+    return true;
+#elif defined(_MSC_VER)
+    std::array<int, 4> info;
+    __cpuid(info.data(), 1);
+    const bool avx = info[2] & (1 << 28);
+    // the operating system has to save the AVX registers on context switches
+    const bool osxsave = info[2] & (1 << 27);
+    return avx && osxsave && (_xgetbv(0) & 0x6) == 0x6;
+#else
+    return __builtin_cpu_supports("avx");
+#endif
+}
+
+const IntersectPacket intersectPacket = supportsAVX() ? intersectPacketAVX : intersectPacketSSE;
+
+/**
+ * @brief Call f(packetIndex, begin, end) for all packets overlapping the faces
+ * [facesBegin, facesEnd), where [begin, end) are the slots of these faces in the packet. Stops
+ * when f returns true.
+ */
+template <typename F>
+void forEachPacket(uint32_t facesBegin, uint32_t facesEnd, F&& f)
+{
+    constexpr uint32_t width = BVH::trianglePacketWidth;
+    for (uint32_t first = facesBegin; first < facesEnd;) {
+        const uint32_t packetIndex = first / width;
+        const uint32_t last = std::min(facesEnd, (packetIndex + 1) * width);
+        if (f(packetIndex, first - packetIndex * width, last - packetIndex * width))
+            return;
+        first = last;
     }
 }
+} // namespace
+#endif
 
-Intersection::Intersection(const Mesh& mesh, const IntersectionRay& ray)
+namespace {
+/// sort the children of a wide node whose bits are set in hits by their entry distance
+uint32_t sortByDistance(uint32_t hits, const std::array<float, BVH::wideNodeWidth>& tNear,
+                        std::array<uint32_t, BVH::wideNodeWidth>& children)
 {
-    const std::vector<BVH::Node>& nodes = mesh.getBVH().getNodes();
-    const std::vector<TriangleIndices>& faces = mesh.getFaces();
+    uint32_t numChildren = 0;
+    for (; hits != 0; hits &= hits - 1) {
+        const uint32_t child = static_cast<uint32_t>(std::countr_zero(hits));
+        uint32_t k = numChildren++;
+        for (; k > 0 && tNear[children[k - 1]] > tNear[child]; --k)
+            children[k] = children[k - 1];
+        children[k] = child;
+    }
+    return numChildren;
+}
 
-    uint32_t currentNodeIndex = 0;
-    while (true) {
-        const BVH::Node& currentNode = nodes.at(currentNodeIndex);
-        // intersected inner node or leaf node
-        if (currentNode.facesEnd && Intersection::intersect(currentNode.bounds, ray)) {
-            const uint32_t leftChildIndex = currentNodeIndex * 2 + 1;
-            // if the node has children, check them instead (first left, then right)
-            if (leftChildIndex < nodes.size() && nodes.at(leftChildIndex).facesEnd) {
-                currentNodeIndex = leftChildIndex;
+/**
+ * @brief Visit all leaves of the BVH that are hit by the ray, nearer children first. The callback
+ * intersects the faces of a leaf and may shorten the ray to cull the remaining nodes behind a hit.
+ * It returns true to stop the traversal.
+ */
+template <typename IntersectFaces>
+void traverse(const BVH& bvh, IntersectionRay& ray, TraversalCounters& counters,
+              IntersectFaces&& intersectFaces)
+{
+    const std::vector<BVH::WideNode>& wideNodes = bvh.getWideNodes();
+    if (!wideNodes.empty()) {
+        struct StackEntry {
+            uint32_t nodeIndex;
+            /// distance at which the ray enters the node
+            float tNear;
+        };
+        // each level of the wide tree replaces at least one level of the binary tree
+        std::array<StackEntry, BVH::maxDepth * (BVH::wideNodeWidth - 1) + 1> stack;
+        uint32_t stackSize = 0;
+        stack[stackSize++] = {0, ray.tMin};
 
+        alignas(32) std::array<float, BVH::wideNodeWidth> tNear;
+        std::array<uint32_t, BVH::wideNodeWidth> children;
+        while (stackSize > 0) {
+            const StackEntry entry = stack[--stackSize];
+            // a closer hit may have been found since the node was pushed
+            if (entry.tNear > ray.tMax)
                 continue;
+
+            const BVH::WideNode& currentNode = wideNodes[entry.nodeIndex];
+            counters.countNode(BVH::wideNodeWidth);
+
+            const uint32_t numChildren = sortByDistance(
+                Intersection::intersect(currentNode, ray, tNear.data()), tNear, children);
+
+            // test the leaves front to back to shorten the ray (or stop) as early as possible,
+            // then push the inner nodes back to front, so the nearest one is visited next
+            for (uint32_t k = 0; k < numChildren; ++k) {
+                const uint32_t child = children[k];
+                if (currentNode.isLeaf(child) && tNear[child] <= ray.tMax
+                    && intersectFaces(currentNode.facesBegin(child), currentNode.facesEnd(child)))
+                    return;
             }
-            else {
-                // leaf node - check all triangles
-                auto faceIndices = mesh.getBVH().getFaceIndices(currentNode);
-                for (uint32_t i : faceIndices) {
-                    const Triangle triangle = mesh.getTriangleFromFace(faces.at(i));
-                    const Intersection its{triangle, ray};
-
-                    if (its.distance < distance) {
-                        *this = its;
-                        triangleIndex = i;
-                    }
-                }
+            for (uint32_t k = numChildren; k-- > 0;) {
+                const uint32_t child = children[k];
+                if (!currentNode.isLeaf(child) && tNear[child] <= ray.tMax)
+                    stack[stackSize++] = {currentNode.offset[child], tNear[child]};
             }
         }
+        return;
+    }
+
+    // the nodes are stored depth-first, so no stack is needed: on a hit, continue with the next
+    // node (the left child or, after a leaf, the next unvisited right child); on a miss, skip
+    // the node's subtree (the fixed order does not allow visiting the nearer child first)
+    const std::vector<BVH::Node>& nodes = bvh.getNodes();
+    uint32_t currentNodeIndex = 0;
+    while (currentNodeIndex < nodes.size()) {
+        const BVH::Node& currentNode = nodes[currentNodeIndex];
+        counters.countNode(1);
+        if (!Intersection::intersect(currentNode.bounds, ray)) {
+            currentNodeIndex = currentNode.isLeaf() ? currentNodeIndex + 1 : currentNode.skip();
+            continue;
+        }
+
+        if (currentNode.isLeaf() && intersectFaces(currentNode.facesBegin(), currentNode.facesEnd()))
+            return;
+
+        ++currentNodeIndex;
+    }
+}
+/// intersect the ray with the triangles [facesBegin, facesEnd) of the BVH leaves, closer hits
+/// are stored in its and shorten the ray
+void intersectLeaf(const BVH& bvh, uint32_t facesBegin, uint32_t facesEnd, IntersectionRay& ray,
+                   Intersection& its)
+{
+    // triangles are stored contiguously in leaf order
+    its.counters.countTriangleTests(facesEnd - facesBegin);
+#ifdef SIMD_LEAF_TEST
+    const std::vector<BVH::TrianglePacket>& packets = bvh.getTrianglePackets();
+    forEachPacket(facesBegin, facesEnd, [&](uint32_t packetIndex, uint32_t begin, uint32_t end) {
+        PacketHit hit;
+        if (intersectPacket(packets[packetIndex], begin, end, ray, hit)
+            && hit.distance < its.distance) {
+            its.distance = ray.tMax = hit.distance;
+            its.bary = hit.bary;
+            its.triangleIndex =
+                bvh.getFaceIndex(packetIndex * BVH::trianglePacketWidth + hit.index);
+        }
+        return false;
+    });
+#else
+    const std::vector<BVH::LeafTriangle>& triangles = bvh.getTriangles();
+    for (uint32_t i = facesBegin; i < facesEnd; ++i) {
+        const Intersection triangleHit{triangles[i], ray};
+
+        if (triangleHit.distance < its.distance) {
+            its.distance = ray.tMax = triangleHit.distance;
+            its.bary = triangleHit.bary;
+            its.triangleIndex = bvh.getFaceIndex(i);
+        }
+    }
+#endif
+}
+
+/**
+ * @brief Conservative bounds of the origins and inverse directions of coherent rays, so boxes can
+ * be tested against all rays at once with interval arithmetic.
+ */
+struct PacketBounds {
+    Point3D originMin{infinity};
+    Point3D originMax{-infinity};
+    Vector3D invDirectionMin{infinity};
+    Vector3D invDirectionMax{-infinity};
+    float tMin{infinity};
+
+    /// returns false if the ray directions diverge (they have to point into the same octant)
+    bool compute(std::span<const IntersectionRay> rays)
+    {
+        *this = {};
+        for (const IntersectionRay& ray : rays) {
+            for (uint32_t axis = 0; axis < 3; ++axis) {
+                const float invDirection = ray.inv_direction[axis];
+                if (!std::isfinite(invDirection)
+                    || (invDirection > 0.0f) != (rays[0].inv_direction[axis] > 0.0f))
+                    return false;
+            }
+            originMin = min(originMin, ray.origin);
+            originMax = max(originMax, ray.origin);
+            invDirectionMin = min(invDirectionMin, ray.inv_direction);
+            invDirectionMax = max(invDirectionMax, ray.inv_direction);
+            tMin = std::min(tMin, ray.tMin);
+        }
+        return true;
+    }
+};
+
+/**
+ * @brief Test all children of a wide node against all rays of the packet at once: returns the
+ * children that may be hit by any ray and stores lower bounds of their entry distances in tNear.
+ */
+uint32_t intersectBounds(const BVH::WideNode& node, const PacketBounds& packet, float tMax,
+                         float* tNear)
+{
+    // all rays point into the same octant, which selects the near and far planes
+    const bool positiveX = packet.invDirectionMin.x > 0.0f;
+    const bool positiveY = packet.invDirectionMin.y > 0.0f;
+    const bool positiveZ = packet.invDirectionMin.z > 0.0f;
+#ifdef WIDE_SLAB_TEST
+    // the extreme distances to a plane are reached at the corners of the intervals
+    auto lowerBound = [&](const float* plane, uint32_t axis) {
+        const SIMDFloat near0 = sub(load(plane), broadcast(packet.originMax[axis]));
+        const SIMDFloat near1 = sub(load(plane), broadcast(packet.originMin[axis]));
+        const SIMDFloat invDirectionMin = broadcast(packet.invDirectionMin[axis]);
+        const SIMDFloat invDirectionMax = broadcast(packet.invDirectionMax[axis]);
+        return min(min(mul(near0, invDirectionMin), mul(near0, invDirectionMax)),
+                   min(mul(near1, invDirectionMin), mul(near1, invDirectionMax)));
+    };
+    auto upperBound = [&](const float* plane, uint32_t axis) {
+        const SIMDFloat far0 = sub(load(plane), broadcast(packet.originMax[axis]));
+        const SIMDFloat far1 = sub(load(plane), broadcast(packet.originMin[axis]));
+        const SIMDFloat invDirectionMin = broadcast(packet.invDirectionMin[axis]);
+        const SIMDFloat invDirectionMax = broadcast(packet.invDirectionMax[axis]);
+        return max(max(mul(far0, invDirectionMin), mul(far0, invDirectionMax)),
+                   max(mul(far1, invDirectionMin), mul(far1, invDirectionMax)));
+    };
 
-        // traverse up after exploring a right child
-        while (currentNodeIndex && currentNodeIndex % 2 == 0)
-            currentNodeIndex = currentNodeIndex / 2 - 1;
+    const SIMDFloat entry = max(max(lowerBound(positiveX ? node.minX : node.maxX, 0),
+                                    lowerBound(positiveY ? node.minY : node.maxY, 1)),
+                                max(lowerBound(positiveZ ? node.minZ : node.maxZ, 2),
+                                    broadcast(packet.tMin)));
+    const SIMDFloat exit = mul(min(min(upperBound(positiveX ? node.maxX : node.minX, 0),
+                                       upperBound(positiveY ? node.maxY : node.minY, 1)),
+                                   upperBound(positiveZ ? node.maxZ : node.minZ, 2)),
+                               broadcast(tFarScale));
+    store(tNear, entry);
 
-        // if we reach the top again, we are done
-        if (!currentNodeIndex)
-            break;
+    return lessEqual(entry, min(exit, broadcast(tMax)));
+#else
+    auto lowerBound = [&](float plane, uint32_t axis) {
+        const float near0 = plane - packet.originMax[axis];
+        const float near1 = plane - packet.originMin[axis];
+        return std::min({near0 * packet.invDirectionMin[axis], near0 * packet.invDirectionMax[axis],
+                         near1 * packet.invDirectionMin[axis], near1 * packet.invDirectionMax[axis]});
+    };
+    auto upperBound = [&](float plane, uint32_t axis) {
+        const float far0 = plane - packet.originMax[axis];
+        const float far1 = plane - packet.originMin[axis];
+        return std::max({far0 * packet.invDirectionMin[axis], far0 * packet.invDirectionMax[axis],
+                         far1 * packet.invDirectionMin[axis], far1 * packet.invDirectionMax[axis]});
+    };
 
-        // check right child after each left child
-        if (currentNodeIndex % 2 == 1)
-            ++currentNodeIndex;
+    uint32_t hits = 0;
+    for (uint32_t k = 0; k < BVH::wideNodeWidth; ++k) {
+        tNear[k] = std::max({lowerBound(positiveX ? node.minX[k] : node.maxX[k], 0),
+                             lowerBound(positiveY ? node.minY[k] : node.maxY[k], 1),
+                             lowerBound(positiveZ ? node.minZ[k] : node.maxZ[k], 2), packet.tMin});
+        const float exit = std::min({upperBound(positiveX ? node.maxX[k] : node.minX[k], 0),
+                                     upperBound(positiveY ? node.maxY[k] : node.minY[k], 1),
+                                     upperBound(positiveZ ? node.maxZ[k] : node.minZ[k], 2)})
+                         * tFarScale;
+        if (tNear[k] <= std::min(exit, tMax))
+            hits |= 1U << k;
     }
+    return hits;
+#endif
+}
+
+/**
+ * @brief Visit all leaves of the wide BVH that may be hit by any ray of the packet, nearer children
+ * first. The callback receives the faces and the bounds of a leaf, intersects the rays with it and
+ * shortens them on hits, which culls the remaining nodes behind the farthest hit of the packet.
+ */
+template <typename IntersectFaces>
+void traversePacket(const BVH& bvh, const PacketBounds& packet,
+                    std::span<const IntersectionRay> rays, TraversalCounters& counters,
+                    IntersectFaces&& intersectFaces)
+{
+    auto farthestHit = [&] {
+        float tMax = 0.0f;
+        for (const IntersectionRay& ray : rays)
+            tMax = std::max(tMax, ray.tMax);
+        return tMax;
+    };
+    float tMax = farthestHit();
+
+    struct StackEntry {
+        uint32_t nodeIndex;
+        /// lower bound of the distance at which the rays enter the node
+        float tNear;
+    };
+    std::array<StackEntry, BVH::maxDepth * (BVH::wideNodeWidth - 1) + 1> stack;
+    uint32_t stackSize = 0;
+    stack[stackSize++] = {0, packet.tMin};
+
+    const std::vector<BVH::WideNode>& wideNodes = bvh.getWideNodes();
+    alignas(32) std::array<float, BVH::wideNodeWidth> tNear;
+    std::array<uint32_t, BVH::wideNodeWidth> children;
+    while (stackSize > 0) {
+        const StackEntry entry = stack[--stackSize];
+        if (entry.tNear > tMax)
+            continue;
+
+        const BVH::WideNode& currentNode = wideNodes[entry.nodeIndex];
+        counters.countNode(BVH::wideNodeWidth);
+
+        const uint32_t numChildren =
+            sortByDistance(intersectBounds(currentNode, packet, tMax, tNear.data()), tNear, children);
+
+        for (uint32_t k = 0; k < numChildren; ++k) {
+            const uint32_t child = children[k];
+            if (currentNode.isLeaf(child) && tNear[child] <= tMax) {
+                const AABB bounds{{currentNode.minX[child], currentNode.minY[child],
+                                   currentNode.minZ[child]},
+                                  {currentNode.maxX[child], currentNode.maxY[child],
+                                   currentNode.maxZ[child]}};
+                intersectFaces(currentNode.facesBegin(child), currentNode.facesEnd(child), bounds);
+                tMax = farthestHit();
+            }
+        }
+        for (uint32_t k = numChildren; k-- > 0;) {
+            const uint32_t child = children[k];
+            if (!currentNode.isLeaf(child) && tNear[child] <= tMax)
+                stack[stackSize++] = {currentNode.offset[child], tNear[child]};
+        }
+    }
+}
+} // namespace
+
+Intersection::Intersection(const Mesh& mesh, const IntersectionRay& ray)
+{
+    const BVH& bvh = mesh.getBVH();
+
+    // shorten the ray to the closest hit so far, so that boxes behind it are culled
+    IntersectionRay closestHitRay{ray};
+
+    traverse(bvh, closestHitRay, counters, [&](uint32_t facesBegin, uint32_t facesEnd) {
+        intersectLeaf(bvh, facesBegin, facesEnd, closestHitRay, *this);
+        return false;
+    });
 }
 
 Intersection::Intersection(const Scene& scene, const IntersectionRay& ray)
 {
-    for (uint32_t i = 0; i < scene.getInstances().size(); ++i) {
-        const Instance& instance = scene.getInstances().at(i);
-        const Point3D localOrigin = instance.toLocal * ray.origin;
-        const Vector3D localDir = instance.toLocal.m * ray.direction;
-        const Ray localRay{localOrigin, localDir, ray.tMin, ray.tMax};
-        const Intersection its{instance.mesh, localRay};
+    const std::vector<Instance>& instances = scene.getInstances();
+    const BVH& instanceBVH = scene.getInstanceBVH();
+
+    TraversalCounters sceneCounters;
+    // the closest hit so far limits the ray and culls the boxes of instances behind it
+    IntersectionRay closestHitRay{ray};
+    const auto intersectInstance = [&](uint32_t i) {
+        const Instance& instance = instances[i];
+        const Intersection its{instance.mesh, instance.rayToLocal(closestHitRay)};
+        sceneCounters += its.counters;
 
         if (its.distance < distance) {
             *this = {its};
+            closestHitRay.tMax = distance;
             instanceIndex = i;
         }
+    };
+
+    // only transform the ray into instances whose world space bounds are hit
+    traverse(instanceBVH, closestHitRay, sceneCounters, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t k = begin; k < end; ++k)
+            intersectInstance(instanceBVH.getFaceIndex(k));
+        return false;
+    });
+    // instances added after building the top-level BVH
+    for (size_t i = scene.getNumIndexedInstances(); i < instances.size(); ++i)
+        intersectInstance(static_cast<uint32_t>(i));
+
+    counters = sceneCounters;
+    TraversalCounters::thisThread() += counters;
+}
+
+void Intersection::intersect(const Scene& scene, std::span<const Ray> rays,
+                             std::span<Intersection> intersections)
+{
+    const std::vector<Instance>& instances = scene.getInstances();
+    const BVH& instanceBVH = scene.getInstanceBVH();
+
+    // the closest hit so far limits each ray
+    std::vector<IntersectionRay> worldRays{rays.begin(), rays.end()};
+    PacketBounds worldBounds;
+    if (instanceBVH.getWideNodes().empty() || !worldBounds.compute(worldRays)) {
+        for (size_t i = 0; i < rays.size(); ++i)
+            intersections[i] = {scene, rays[i]};
+        return;
+    }
+    std::fill(intersections.begin(), intersections.end(), Intersection{});
+
+    // the rays that hit the bounds of the current instance, in its local space
+    std::vector<IntersectionRay> localRays;
+    std::vector<uint32_t> rayIndices;
+    std::vector<Intersection> localIntersections;
+    TraversalCounters packetCounters;
+    const auto intersectInstance = [&](uint32_t instanceIndex) {
+        const Instance& instance = instances[instanceIndex];
+        const AABB instanceBounds = instance.getBounds();
+        localRays.clear();
+        rayIndices.clear();
+        for (uint32_t i = 0; i < worldRays.size(); ++i) {
+            if (intersect(instanceBounds, worldRays[i])) {
+                localRays.push_back(instance.rayToLocal(worldRays[i]));
+                rayIndices.push_back(i);
+            }
+        }
+
+        const BVH& bvh = instance.mesh.getBVH();
+        PacketBounds localBounds;
+        localIntersections.assign(localRays.size(), Intersection{});
+        if (localRays.size() > 1 && !bvh.getWideNodes().empty() && localBounds.compute(localRays)) {
+            traversePacket(bvh, localBounds, localRays, packetCounters,
+                           [&](uint32_t facesBegin, uint32_t facesEnd, const AABB& leafBounds) {
+                               for (uint32_t k = 0; k < localRays.size(); ++k) {
+                                   if (intersect(leafBounds, localRays[k]))
+                                       intersectLeaf(bvh, facesBegin, facesEnd, localRays[k],
+                                                     localIntersections[k]);
+                               }
+                           });
+        }
+        else {
+            // the transformation made the rays diverge
+            for (uint32_t k = 0; k < localRays.size(); ++k)
+                localIntersections[k] = {instance.mesh, localRays[k]};
+        }
+
+        // the local rays were limited to the closest hits so far, so all hits are closer
+        for (uint32_t k = 0; k < localRays.size(); ++k) {
+            Intersection& its = intersections[rayIndices[k]];
+            const Intersection& localIts = localIntersections[k];
+            its.counters += localIts.counters;
+            if (localIts) {
+                its.distance = worldRays[rayIndices[k]].tMax = localIts.distance;
+                its.bary = localIts.bary;
+                its.triangleIndex = localIts.triangleIndex;
+                its.instanceIndex = instanceIndex;
+            }
+        }
+    };
+
+    traversePacket(instanceBVH, worldBounds, worldRays, packetCounters,
+                   [&](uint32_t begin, uint32_t end, const AABB&) {
+                       for (uint32_t k = begin; k < end; ++k)
+                           intersectInstance(instanceBVH.getFaceIndex(k));
+                   });
+    // instances added after building the top-level BVH
+    for (size_t i = scene.getNumIndexedInstances(); i < instances.size(); ++i)
+        intersectInstance(static_cast<uint32_t>(i));
+
+    // all rays of the packet share the visited nodes (which were only visited once though)
+    TraversalCounters::thisThread() += packetCounters;
+    for (Intersection& its : intersections) {
+        TraversalCounters::thisThread() += its.counters;
+        its.counters += packetCounters;
     }
 }
 
+bool Intersection::occluded(const BVH::LeafTriangle& triangle, const IntersectionRay& ray)
+{
+    // the barycentric coordinates are a by-product of the test, so use the same kernel
+    return Intersection{triangle, ray};
+}
+
+bool Intersection::occluded(const Mesh& mesh, const IntersectionRay& ray)
+{
+    TraversalCounters counters;
+    const bool hit = occluded(mesh, ray, counters);
+    TraversalCounters::thisThread() += counters;
+    return hit;
+}
+
+bool Intersection::occluded(const Mesh& mesh, const IntersectionRay& ray,
+                            TraversalCounters& counters)
+{
+#ifdef SIMD_LEAF_TEST
+    const std::vector<BVH::TrianglePacket>& packets = mesh.getBVH().getTrianglePackets();
+#else
+    const std::vector<BVH::LeafTriangle>& triangles = mesh.getBVH().getTriangles();
+#endif
+
+    IntersectionRay anyHitRay{ray};
+    bool hit = false;
+    traverse(mesh.getBVH(), anyHitRay, counters, [&](uint32_t facesBegin, uint32_t facesEnd) {
+        counters.countTriangleTests(facesEnd - facesBegin);
+#ifdef SIMD_LEAF_TEST
+        forEachPacket(facesBegin, facesEnd, [&](uint32_t packetIndex, uint32_t begin, uint32_t end) {
+            PacketHit packetHit;
+            hit = intersectPacket(packets[packetIndex], begin, end, anyHitRay, packetHit);
+            return hit;
+        });
+#else
+        for (uint32_t i = facesBegin; i < facesEnd && !hit; ++i)
+            hit = occluded(triangles[i], anyHitRay);
+#endif
+        return hit;
+    });
+    return hit;
+}
+
+bool Intersection::occluded(const Scene& scene, const IntersectionRay& ray)
+{
+    const std::vector<Instance>& instances = scene.getInstances();
+    const BVH& instanceBVH = scene.getInstanceBVH();
+
+    IntersectionRay anyHitRay{ray};
+    TraversalCounters counters;
+    bool hit = false;
+    traverse(instanceBVH, anyHitRay, counters, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t k = begin; k < end && !hit; ++k)
+            hit = occluded(instances[instanceBVH.getFaceIndex(k)].mesh,
+                           instances[instanceBVH.getFaceIndex(k)].rayToLocal(anyHitRay), counters);
+        return hit;
+    });
+
+    for (size_t i = scene.getNumIndexedInstances(); i < instances.size() && !hit; ++i)
+        hit = occluded(instances[i].mesh, instances[i].rayToLocal(anyHitRay), counters);
+
+    counters.countShadowRay();
+    TraversalCounters::thisThread() += counters;
+    return hit;
+}
+
 ShadingIntersection::ShadingIntersection(const Scene& scene, const Intersection& its)
     : Intersection{its}
 {
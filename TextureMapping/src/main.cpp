@@ -42,6 +42,18 @@ public:
 
         // setup the scene
         {
+            // load all files concurrently in the background, the setup below only waits for the
+            // ones that are not ready yet when it needs them
+            for (const char* meshFilename :
+                 {"../meshes/big_bunny.obj", "../meshes/gdv.obj", "../meshes/uv_sphere.obj",
+                  "../meshes/CubeTop.obj", "../meshes/CubeBack.obj", "../meshes/CubeBottom.obj",
+                  "../meshes/CubeLeft.obj", "../meshes/CubeRight.obj"})
+                Instance::prefetch(meshFilename);
+            for (const char* textureFilename :
+                 {"../textures/stone_wall_diff_2k.jpg", "../textures/stone_wall_nor_gl_2k.jpg",
+                  "../textures/stone_wall_rough_2k.jpg", "../textures/stone_wall_disp_2k.jpg"})
+                Texture::prefetch(textureFilename);
+
             // selection of Materials
             struct MaterialDatabase {
                 const Material::Diffuse boxRed{{0.8f, 0.4f, 0.3f}};
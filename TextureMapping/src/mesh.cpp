@@ -1,299 +1,618 @@
 #include <geometry/mesh.h>
 
+#include <common/binary_file.h>
+#include <geometry/aabb.h>
+
 #include <algorithm>
-#include <fstream>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
 #include <iostream>
 #include <optional>
-#include <sstream>
 #include <stdexcept>
+#include <string>
 
-using namespace std::string_literals;
-
-void Mesh::loadOBJ(const std::string_view filename)
-{
-    clear();
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
-    std::ifstream file{filename.data()};
-    file.exceptions(std::ios::badbit);
-    std::string buffer;
+using namespace std::string_literals;
 
-    if (!file)
-        throw std::runtime_error("failed to open the OBJ file "s + filename.data()
-                                 + "\nmake sure you run the program in the correct folder!"s);
+#if defined(_WIN32)
+using OMPIndex = int32_t;
+#else
+using OMPIndex = uint32_t;
+#endif
+
+namespace {
+/// OBJ files are split into chunks of at least this many bytes to be parsed in parallel
+constexpr size_t minOBJChunkSize{1U << 20};
+/// marks indices that cannot be valid (e.g. 0, OBJ indices start at 1)
+constexpr uint32_t invalidIndex{~0U};
+
+/**
+ * @brief Scans the characters of one line of an OBJ file without allocating. Numbers are parsed
+ * like operator>> of a stream with the "C" locale: leading whitespace is skipped, and a failed read
+ * stores zero and does not advance.
+ */
+class LineScanner {
+public:
+    LineScanner(std::string_view line) : current{line.data()}, end{line.data() + line.size()} {}
+
+    /// the next character (or '\0' at the end of the line)
+    char peek() const { return current < end ? *current : '\0'; }
+    void skip() { ++current; }
+
+    bool read(float& value)
+    {
+        if (!skipToNumber(true)) {
+            value = 0.0f;
+            return false;
+        }
+#if __cpp_lib_to_chars >= 201611L
+        const auto [next, error] = std::from_chars(current, end, value);
+        if (error != std::errc{}) {
+            value = 0.0f;
+            return false;
+        }
+        current = next;
+#else
+        // strtof needs a null terminated string (the mapped file is not)
+        std::array<char, 64> buffer{};
+        const size_t length = std::min(static_cast<size_t>(end - current), buffer.size() - 1);
+        std::copy_n(current, length, buffer.begin());
+        char* next;
+        value = std::strtof(buffer.data(), &next);
+        if (next == buffer.data())
+            return false;
+        current += next - buffer.data();
+#endif
+        return true;
+    }
 
-    auto check = [&]() -> void {
-        if (!file) {
-            file.close();
-            clear();
-            throw std::runtime_error("failed to parse the OBJ file "s + filename.data()
-                                     + "\ncurrent line:\n"s + buffer);
+    bool read(int64_t& value)
+    {
+        if (!skipToNumber(false)) {
+            value = 0;
+            return false;
         }
-    };
+        const auto [next, error] = std::from_chars(current, end, value);
+        if (error != std::errc{}) {
+            value = 0;
+            return false;
+        }
+        current = next;
+        return true;
+    }
+
+private:
+    /// skip whitespace and a plus sign, returns whether a number may follow (floats may also
+    /// start with a decimal point)
+    bool skipToNumber(bool isFloat)
+    {
+        auto isSpace = [](char c) { return c == ' ' || (c >= '\t' && c <= '\r'); };
+        auto isDigit = [](char c) { return c >= '0' && c <= '9'; };
+
+        while (current < end && isSpace(*current))
+            ++current;
+
+        const char* number = current;
+        if (number < end && (*number == '+' || *number == '-'))
+            ++number;
+        // (streams do not accept "inf" and "nan" either)
+        if (number == end || !(isDigit(*number) || (isFloat && *number == '.')))
+            return false;
+
+        // from_chars does not accept a plus sign
+        if (*current == '+')
+            ++current;
+        return true;
+    }
 
-    std::vector<Normal3D> objNormals;
-    std::vector<Point2D> objTexCoords;
+    const char* current;
+    const char* end;
+};
+
+/**
+ * @brief The records parsed from a range of lines of an OBJ file. Indices are resolved relative to
+ * the elements of the chunk, so the chunks of a file can be parsed independently and stitched
+ * together afterwards.
+ */
+struct OBJChunk {
+    std::vector<Point3D> vertices;
+    std::vector<Normal3D> normals;
+    std::vector<Point2D> texCoords;
+    AABB bounds;
+
+    std::vector<TriangleIndices> faces;
+    /// (like the faces of the mesh, these only reach up to the last face with normals/coordinates)
     std::vector<std::optional<TriangleIndices>> normalIndices, textureIndices;
 
-    size_t currentSmoothGroup = 0;
+    /// faces with negative (relative) indices, which count back from the elements of the chunk and
+    /// need the number of elements of the preceding chunks added: face index and a bit mask of the
+    /// relative indices (v1, v2, v3, vt1, vt2, vt3, vn1, vn2, vn3)
+    std::vector<std::pair<uint32_t, uint16_t>> relativeIndices;
 
-    while (file) {
-        std::getline(file, buffer);
+    /// "s" records: number of faces in the chunk before the record and whether it was "s off"
+    std::vector<std::pair<size_t, bool>> smoothGroupRecords;
+};
+
+/// parse the given lines of an OBJ file
+OBJChunk parseOBJ(std::string_view text)
+{
+    OBJChunk chunk;
+
+    for (size_t lineBegin = 0; lineBegin < text.size();) {
+        size_t lineEnd = text.find('\n', lineBegin);
+        if (lineEnd == text.npos)
+            lineEnd = text.size();
+        const std::string_view buffer = text.substr(lineBegin, lineEnd - lineBegin);
+        lineBegin = lineEnd + 1;
 
         if (buffer.empty() || buffer.starts_with("#"))
             continue;
 
-        std::istringstream in{buffer};
-        char type, subtype;
-        in >> std::noskipws >> type >> subtype >> std::skipws;
+        const char type = buffer[0];
+        const char subtype = buffer.size() > 1 ? buffer[1] : '\0';
+        LineScanner in{buffer.substr(std::min<size_t>(buffer.size(), 2))};
 
         if (type == 'v') {
             if (subtype == 't') {
                 Point2D vt;
-                in >> vt.x >> vt.y;
-                check();
+                in.read(vt.x) && in.read(vt.y);
 
-                objTexCoords.push_back(vt);
+                chunk.texCoords.push_back(vt);
             }
             else if (subtype == ' ' || subtype == '\t' || subtype == 'n') {
                 Point3D v;
-                in >> v.x >> v.y >> v.z;
-                check();
+                in.read(v.x) && in.read(v.y) && in.read(v.z);
 
                 if (subtype == 'n') {
-                    objNormals.push_back(v);
+                    chunk.normals.push_back(v);
                 }
                 else {
-                    aabb.extend(v);
-                    vertices.push_back(v);
+                    chunk.bounds.extend(v);
+                    chunk.vertices.push_back(v);
                 }
             }
         }
         else if (type == 'f') {
             TriangleIndices t, tn, tt;
+            /// which indices of each corner are relative (bits for v, vt and vn)
+            std::array<uint16_t, 3> relative{};
 
             bool hasNormal{true}, hasTexture{true};
 
-            auto readIndices = [&](uint32_t& v, uint32_t& vt, uint32_t& vn) -> void {
-                in >> v;
-                --v;
+            // positive indices start at 1, negative ones count back from the last element so far
+            auto readIndex = [&](uint32_t& index, size_t numElements, uint16_t& relativeBits,
+                                 uint16_t bit) -> bool {
+                int64_t value;
+                if (!in.read(value))
+                    return false;
+                // 0 and indices beyond the 32 bit range are invalid (rejected after stitching)
+                if (value == 0 || value > int64_t{UINT32_MAX} || value < -int64_t{UINT32_MAX})
+                    index = invalidIndex;
+                else if (value < 0) {
+                    index = static_cast<uint32_t>(static_cast<int64_t>(numElements) + value);
+                    relativeBits |= bit;
+                }
+                else
+                    index = static_cast<uint32_t>(value - 1);
+                return true;
+            };
 
-                if (in) {
-                    // texture coordinate and vertex normal id (currently unused)
-                    if (in.peek() == '/') {
-                        in.ignore();
-                        if (in.peek() != '/') {
-                            in >> vt;
-                            if (in)
-                                --vt;
-                            else
-                                hasTexture = false;
-                        }
-                        else
-                            hasTexture = false;
-                        if (in.peek() == '/') {
-                            in.ignore();
-                            in >> vn;
-                            if (in)
-                                --vn;
-                            else
-                                hasNormal = false;
+            // returns false if there is no further vertex
+            auto readIndices = [&](uint32_t& v, uint32_t& vt, uint32_t& vn,
+                                   uint16_t& relativeBits) -> bool {
+                relativeBits = 0;
+                if (!readIndex(v, chunk.vertices.size(), relativeBits, 1))
+                    return false;
+
+                // texture coordinate and vertex normal id
+                if (in.peek() == '/') {
+                    in.skip();
+                    if (in.peek() != '/') {
+                        if (!readIndex(vt, chunk.texCoords.size(), relativeBits, 2)) {
+                            // (a stream fails here and cannot find the normal anymore)
+                            hasTexture = hasNormal = false;
+                            return true;
                         }
-                        else
+                    }
+                    else
+                        hasTexture = false;
+                    if (in.peek() == '/') {
+                        in.skip();
+                        if (!readIndex(vn, chunk.normals.size(), relativeBits, 4))
                             hasNormal = false;
                     }
                     else
-                        hasNormal = hasTexture = false;
-                    in.clear();
+                        hasNormal = false;
                 }
+                else
+                    hasNormal = hasTexture = false;
+                return true;
             };
 
-            readIndices(t.v1, tt.v1, tn.v1);
-            readIndices(t.v2, tt.v2, tn.v2);
-            readIndices(t.v3, tt.v3, tn.v3);
-            check();
+            if (!readIndices(t.v1, tt.v1, tn.v1, relative[0])
+                || !readIndices(t.v2, tt.v2, tn.v2, relative[1]))
+                continue;
 
-            while (in) {
+            // triangulate polygons as a fan around the first vertex
+            while (readIndices(t.v3, tt.v3, tn.v3, relative[2])) {
                 if (hasNormal) {
-                    if (normalIndices.size() < faces.size())
-                        normalIndices.resize(faces.size());
-                    normalIndices.emplace_back(tn);
+                    if (chunk.normalIndices.size() < chunk.faces.size())
+                        chunk.normalIndices.resize(chunk.faces.size());
+                    chunk.normalIndices.emplace_back(tn);
                 }
                 if (hasTexture) {
-                    if (textureIndices.size() < faces.size())
-                        textureIndices.resize(faces.size());
-                    textureIndices.emplace_back(tt);
+                    if (chunk.textureIndices.size() < chunk.faces.size())
+                        chunk.textureIndices.resize(chunk.faces.size());
+                    chunk.textureIndices.emplace_back(tt);
+                }
+
+                // regroup the bits by kind of index
+                uint16_t relativeMask = 0;
+                for (uint16_t corner = 0; corner < 3; ++corner) {
+                    for (uint16_t kind = 0; kind < 3; ++kind) {
+                        if (relative[corner] & (1U << kind))
+                            relativeMask |= 1U << (kind * 3 + corner);
+                    }
                 }
-                faces.push_back(t);
+                if (relativeMask)
+                    chunk.relativeIndices.emplace_back(chunk.faces.size(), relativeMask);
+                chunk.faces.push_back(t);
 
                 t.v2 = t.v3;
                 tn.v2 = tn.v3;
                 tt.v2 = tt.v3;
-                readIndices(t.v3, tt.v3, tn.v3);
+                relative[1] = relative[2];
             }
         }
         else if (type == 's') {
+            chunk.smoothGroupRecords.emplace_back(chunk.faces.size(),
+                                                  buffer.find("off") != buffer.npos);
+        }
+    }
+
+    return chunk;
+}
+
+/// inclusive prefix sum: the threads sum up contiguous chunks, which are then offset by the sums
+/// of the preceding chunks
+void inclusiveScan(const std::vector<float>& values, std::vector<float>& sums, bool parallel)
+{
+    std::vector<float> chunkSums;
+
+#pragma omp parallel if (parallel)
+    {
+        size_t numChunks = 1;
+        size_t chunk = 0;
+#ifdef _OPENMP
+        numChunks = static_cast<size_t>(omp_get_num_threads());
+        chunk = static_cast<size_t>(omp_get_thread_num());
+#endif
+        const size_t begin = values.size() * chunk / numChunks;
+        const size_t end = values.size() * (chunk + 1) / numChunks;
+
+#pragma omp single
+        chunkSums.assign(numChunks + 1, 0.0f);
+
+        float sum = 0.0f;
+        for (size_t i = begin; i < end; ++i)
+            sums[i] = sum += values[i];
+        chunkSums[chunk + 1] = sum;
+
+#pragma omp barrier
+#pragma omp single
+        for (size_t i = 0; i < numChunks; ++i)
+            chunkSums[i + 1] += chunkSums[i];
+
+        if (chunk > 0) {
+            for (size_t i = begin; i < end; ++i)
+                sums[i] += chunkSums[chunk];
+        }
+    }
+}
+} // namespace
+
+void Mesh::loadOBJ(const std::string_view filename, bool parallel)
+{
+    clear();
+
+    const MappedFile file{std::string{filename}};
+    if (!file)
+        throw std::runtime_error("failed to open the OBJ file "s + std::string{filename}
+                                 + "\nmake sure you run the program in the correct folder!"s);
+
+    const std::string_view contents{reinterpret_cast<const char*>(file.data().data()),
+                                    file.data().size()};
+
+    // split the file at line boundaries into a few chunks per thread (for load balancing)
+    std::vector<std::string_view> chunkTexts;
+    {
+        size_t numChunks = 1;
+#ifdef _OPENMP
+        if (parallel)
+            numChunks = static_cast<size_t>(omp_get_max_threads()) * 4;
+#endif
+        numChunks = std::clamp<size_t>(contents.size() / minOBJChunkSize, 1, numChunks);
+
+        size_t chunkBegin = 0;
+        for (size_t i = 1; i <= numChunks && chunkBegin < contents.size(); ++i) {
+            size_t chunkEnd = contents.size() * i / numChunks;
+            if (chunkEnd < chunkBegin)
+                chunkEnd = chunkBegin;
+            chunkEnd = std::min(contents.find('\n', chunkEnd), contents.size());
+            if (chunkEnd < contents.size())
+                ++chunkEnd;
+            chunkTexts.push_back(contents.substr(chunkBegin, chunkEnd - chunkBegin));
+            chunkBegin = chunkEnd;
+        }
+    }
+
+    std::vector<OBJChunk> chunks(chunkTexts.size());
+#pragma omp parallel for schedule(dynamic) if (chunks.size() > 1)
+    for (OMPIndex i = 0; i < static_cast<OMPIndex>(chunks.size()); ++i)
+        chunks[i] = parseOBJ(chunkTexts[i]);
+
+    // stitch the chunks together: prefix sums of the element counts give the offsets of the chunks
+    struct Offsets {
+        size_t vertices{0}, normals{0}, texCoords{0}, faces{0};
+    };
+    std::vector<Offsets> offsets(chunks.size() + 1);
+    bool hasNormalIndices{false}, hasTextureIndices{false};
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        offsets[i + 1].vertices = offsets[i].vertices + chunks[i].vertices.size();
+        offsets[i + 1].normals = offsets[i].normals + chunks[i].normals.size();
+        offsets[i + 1].texCoords = offsets[i].texCoords + chunks[i].texCoords.size();
+        offsets[i + 1].faces = offsets[i].faces + chunks[i].faces.size();
+        hasNormalIndices |= !chunks[i].normalIndices.empty();
+        hasTextureIndices |= !chunks[i].textureIndices.empty();
+        aabb += chunks[i].bounds;
+    }
+
+    // replay the "s" records in the order of the file
+    size_t currentSmoothGroup = 0;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        for (const auto& [chunkFaces, off] : chunks[i].smoothGroupRecords) {
+            const size_t numFaces = offsets[i].faces + chunkFaces;
             // end current smooth group
-            if (faces.size() > currentSmoothGroup)
-                smoothGroups.emplace_back(currentSmoothGroup, faces.size());
-            if (buffer.find("off") != buffer.npos)
-                currentSmoothGroup = -1UL;
-            else
-                currentSmoothGroup = faces.size();
+            if (numFaces > currentSmoothGroup)
+                smoothGroups.emplace_back(currentSmoothGroup, numFaces);
+            currentSmoothGroup = off ? -1UL : numFaces;
         }
     }
 
-    if (faces.size() > currentSmoothGroup)
-        smoothGroups.emplace_back(currentSmoothGroup, faces.size());
+    if (offsets.back().faces > currentSmoothGroup)
+        smoothGroups.emplace_back(currentSmoothGroup, offsets.back().faces);
+
+    std::vector<Normal3D> objNormals(offsets.back().normals);
+    std::vector<Point2D> objTexCoords(offsets.back().texCoords);
+    std::vector<std::optional<TriangleIndices>> normalIndices(
+        hasNormalIndices ? offsets.back().faces : 0);
+    std::vector<std::optional<TriangleIndices>> textureIndices(
+        hasTextureIndices ? offsets.back().faces : 0);
+    vertices.resize(offsets.back().vertices);
+    faces.resize(offsets.back().faces);
+
+#pragma omp parallel for schedule(dynamic) if (chunks.size() > 1)
+    for (OMPIndex i = 0; i < static_cast<OMPIndex>(chunks.size()); ++i) {
+        OBJChunk& chunk = chunks[i];
+        const Offsets& offset = offsets[i];
+
+        // resolve the relative indices
+        for (const auto& [face, mask] : chunk.relativeIndices) {
+            auto addOffset = [mask](TriangleIndices& indices, uint16_t shift, size_t elementOffset) {
+                const uint32_t add = static_cast<uint32_t>(elementOffset);
+                indices.v1 += (mask >> shift) & 1U ? add : 0U;
+                indices.v2 += (mask >> (shift + 1)) & 1U ? add : 0U;
+                indices.v3 += (mask >> (shift + 2)) & 1U ? add : 0U;
+            };
+            addOffset(chunk.faces[face], 0, offset.vertices);
+            if (face < chunk.textureIndices.size() && chunk.textureIndices[face])
+                addOffset(*chunk.textureIndices[face], 3, offset.texCoords);
+            if (face < chunk.normalIndices.size() && chunk.normalIndices[face])
+                addOffset(*chunk.normalIndices[face], 6, offset.normals);
+        }
+
+        std::copy(chunk.vertices.begin(), chunk.vertices.end(),
+                  vertices.begin() + offset.vertices);
+        std::copy(chunk.normals.begin(), chunk.normals.end(), objNormals.begin() + offset.normals);
+        std::copy(chunk.texCoords.begin(), chunk.texCoords.end(),
+                  objTexCoords.begin() + offset.texCoords);
+        std::copy(chunk.faces.begin(), chunk.faces.end(), faces.begin() + offset.faces);
+        std::copy(chunk.normalIndices.begin(), chunk.normalIndices.end(),
+                  normalIndices.begin() + offset.faces);
+        std::copy(chunk.textureIndices.begin(), chunk.textureIndices.end(),
+                  textureIndices.begin() + offset.faces);
+        chunk = {};
+    }
+
+    // check all indices once, so that the passes below can access the arrays directly
+    {
+        auto isValidFace = [&](size_t i) {
+            auto inRange = [](const TriangleIndices& t, size_t size) {
+                return t.v1 < size && t.v2 < size && t.v3 < size;
+            };
+            return inRange(faces[i], vertices.size())
+                && (i >= normalIndices.size() || !normalIndices[i]
+                    || inRange(*normalIndices[i], objNormals.size()))
+                && (i >= textureIndices.size() || !textureIndices[i]
+                    || inRange(*textureIndices[i], objTexCoords.size()));
+        };
+        bool valid = true;
+#pragma omp parallel for reduction(&& : valid) if (parallel)
+        for (OMPIndex i = 0; i < static_cast<OMPIndex>(faces.size()); ++i)
+            valid = valid && isValidFace(i);
+
+        if (!valid) {
+            size_t invalidFace = 0;
+            while (isValidFace(invalidFace))
+                ++invalidFace;
+            clear();
+            throw std::runtime_error("failed to parse the OBJ file "s + std::string{filename}
+                                     + "\nface "s + std::to_string(invalidFace + 1)
+                                     + " references a missing vertex, normal or texture "s
+                                     + "coordinate"s);
+        }
+    }
 
-    file.close();
+    computeFaceAttributes(parallel);
 
-    // duplicate some shared vertices
+    // duplicate some shared vertices (in the order of the faces, which is inherently serial)
     {
         const bool hasTexCoords = !objTexCoords.empty();
         std::vector<std::optional<uint32_t>> texCoordPerVertex(hasTexCoords ? vertices.size()
                                                                             : 0UL);
         std::vector<bool> verticesUsedForFlatNormal(vertices.size());
-        bool shadeFlat = true;
-        auto currentSmoothGroup = smoothGroups.cbegin();
-        for (size_t i = 0; i < faces.size(); ++i) {
-            if (currentSmoothGroup != smoothGroups.end()) {
-                if (i == currentSmoothGroup->first)
-                    shadeFlat = false;
-                if (i == currentSmoothGroup->second) {
-                    shadeFlat = true;
-                    ++currentSmoothGroup;
-                }
+
+        // the first face using a vertex claims its texture coordinate, later faces get a copy
+        auto claimTexCoord = [&](uint32_t& vertex, uint32_t texCoord) -> bool {
+            if (texCoordPerVertex[vertex] && *texCoordPerVertex[vertex] != texCoord) {
+                const uint32_t copyIndex = static_cast<uint32_t>(vertices.size());
+                vertices.push_back(vertices[vertex]);
+                vertex = copyIndex;
+                return true;
             }
+            texCoordPerVertex[vertex] = texCoord;
+            return false;
+        };
 
-            TriangleIndices& face = faces.at(i);
+        for (size_t i = 0; i < faces.size(); ++i) {
+            TriangleIndices& face = faces[i];
 
             // duplicate reused vertices if they have a different texture coordinate
-            if (i < textureIndices.size() && textureIndices.at(i)) {
-                const TriangleIndices& tt = *textureIndices.at(i);
-
-                if (texCoordPerVertex.at(face.v1) && *texCoordPerVertex.at(face.v1) != tt.v1) {
-                    const uint32_t copyIndex = vertices.size();
-                    vertices.push_back(vertices.at(face.v1));
-                    face.v1 = copyIndex;
-                }
-                else
-                    texCoordPerVertex.at(face.v1) = tt.v1;
-
-                if (texCoordPerVertex.at(face.v2) && *texCoordPerVertex.at(face.v2) != tt.v2) {
-                    const uint32_t copyIndex = vertices.size();
-                    vertices.push_back(vertices.at(face.v2));
-                    face.v2 = copyIndex;
-                }
-                else
-                    texCoordPerVertex.at(face.v2) = tt.v2;
-
-                if (texCoordPerVertex.at(face.v3) && *texCoordPerVertex.at(face.v3) != tt.v3) {
-                    const uint32_t copyIndex = vertices.size();
-                    vertices.push_back(vertices.at(face.v3));
-                    face.v3 = copyIndex;
+            if (i < textureIndices.size() && textureIndices[i]) {
+                const TriangleIndices& tt = *textureIndices[i];
+                claimTexCoord(face.v1, tt.v1);
+                claimTexCoord(face.v2, tt.v2);
+                if (claimTexCoord(face.v3, tt.v3))
                     continue;
-                }
-                else
-                    texCoordPerVertex.at(face.v3) = tt.v3;
             }
 
             // duplicate reused vertices if they are used to set the normal for flat shading
-            if (shadeFlat) {
-                if (verticesUsedForFlatNormal.at(face.v3)) {
-                    const uint32_t copyIndex = vertices.size();
-                    vertices.push_back(vertices.at(face.v3));
+            if (!faceAttributes[i].isSmooth()) {
+                if (verticesUsedForFlatNormal[face.v3]) {
+                    const uint32_t copyIndex = static_cast<uint32_t>(vertices.size());
+                    vertices.push_back(vertices[face.v3]);
                     face.v3 = copyIndex;
                     continue;
                 }
             }
-            verticesUsedForFlatNormal.at(face.v3) = true;
+            verticesUsedForFlatNormal[face.v3] = true;
         }
     }
 
     // compute face areas, and normals (and texture coordinates, if any) per vertex
     {
-        std::vector<float> weights(vertices.size());
-
-        normals.resize(vertices.size());
-        if (textureIndices.size())
-            texCoords.resize(vertices.size());
-        faceAreas.resize(faces.size());
-        faceAreaPrefixSum.resize(faces.size());
-
-        bool shadeFlat = true;
-        auto currentSmoothGroup = smoothGroups.cbegin();
-        float areaSum = 0.0f;
-
-        for (size_t i = 0; i < faces.size(); ++i) {
-            if (currentSmoothGroup != smoothGroups.end()) {
-                if (i == currentSmoothGroup->first)
-                    shadeFlat = false;
-                if (i == currentSmoothGroup->second) {
-                    shadeFlat = true;
-                    ++currentSmoothGroup;
-                }
-            }
-
-            const TriangleIndices& t = faces.at(i);
-            Vector3D v1v2 = vertices.at(t.v2) - vertices.at(t.v1);
-            Vector3D v1v3 = vertices.at(t.v3) - vertices.at(t.v1);
-            Vector3D v2v3 = vertices.at(t.v3) - vertices.at(t.v2);
+        const size_t numFaces = faces.size();
+        const size_t numVertices = vertices.size();
+
+        /// normal and the weights of the corners of a face for the vertex normals
+        struct FaceShading {
+            Normal3D up;
+            std::array<float, 3> weights;
+        };
+        std::vector<FaceShading> faceShading(numFaces);
+        faceAreas.resize(numFaces);
+
+#pragma omp parallel for if (parallel)
+        for (OMPIndex i = 0; i < static_cast<OMPIndex>(numFaces); ++i) {
+            const TriangleIndices& t = faces[i];
+            Vector3D v1v2 = vertices[t.v2] - vertices[t.v1];
+            Vector3D v1v3 = vertices[t.v3] - vertices[t.v1];
+            Vector3D v2v3 = vertices[t.v3] - vertices[t.v2];
             const Vector3D upTimes2Area = cross(v1v2, v1v3);
-            const float area = upTimes2Area.norm() * 0.5f;
-            areaSum += area;
-            faceAreaPrefixSum.at(i) = areaSum;
-            faceAreas.at(i) = area;
-
-            const Normal3D up = normalize(upTimes2Area);
+            faceAreas[i] = upTimes2Area.norm() * 0.5f;
+            faceShading[i].up = normalize(upTimes2Area);
 
-            if (shadeFlat) {
-                normals.at(t.v3) = up;
-            }
-            else {
+            if (faceAttributes[i].isSmooth()) {
                 v1v2 = normalize(v1v2);
                 v1v3 = normalize(v1v3);
                 v2v3 = normalize(v2v3);
 
                 // weight = angle covered by the triangle
-                const float w1 = std::abs(dot(v1v2, v1v3));
-                const float w2 = std::abs(dot(v1v2, v2v3));
-                const float w3 = std::abs(dot(v2v3, v1v3));
-
-                // update factor for incremental mean
-                float u1 = weights.at(t.v1) > 0.0f ? 1.0f : w1;
-                float u2 = weights.at(t.v2) > 0.0f ? 1.0f : w2;
-                float u3 = weights.at(t.v3) > 0.0f ? 1.0f : w3;
-
-                weights.at(t.v1) += w1;
-                weights.at(t.v2) += w2;
-                weights.at(t.v3) += w3;
-
-                u1 = w1 > 0.0f ? w1 / weights.at(t.v1) : u1;
-                u2 = w2 > 0.0f ? w2 / weights.at(t.v2) : u2;
-                u3 = w3 > 0.0f ? w3 / weights.at(t.v3) : u3;
-
-                if (i < normalIndices.size() && normalIndices.at(i)) {
-                    const TriangleIndices& tn = *normalIndices.at(i);
-                    normals.at(t.v1) += (objNormals.at(tn.v1) - normals.at(t.v1)) * u1;
-                    normals.at(t.v2) += (objNormals.at(tn.v2) - normals.at(t.v2)) * u2;
-                    normals.at(t.v3) += (objNormals.at(tn.v3) - normals.at(t.v3)) * u3;
+                faceShading[i].weights = {std::abs(dot(v1v2, v1v3)), std::abs(dot(v1v2, v2v3)),
+                                          std::abs(dot(v2v3, v1v3))};
+            }
+        }
+
+        faceAreaPrefixSum.resize(numFaces);
+        inclusiveScan(faceAreas, faceAreaPrefixSum, parallel);
+        invTotalArea = 1.0f / (numFaces ? faceAreaPrefixSum.back() : 0.0f);
+
+        // the faces of each vertex in ascending order (corner index in the lowest two bits), so
+        // that the vertex normals can be accumulated independently in the order of the faces
+        std::vector<uint32_t> vertexFacesBegin(numVertices + 1);
+        std::vector<uint32_t> vertexFaces(numFaces * 3);
+        {
+            std::vector<std::atomic_uint32_t> fill(numVertices);
+#pragma omp parallel for if (parallel)
+            for (OMPIndex i = 0; i < static_cast<OMPIndex>(numFaces); ++i) {
+                for (const uint32_t v : {faces[i].v1, faces[i].v2, faces[i].v3})
+                    fill[v].fetch_add(1, std::memory_order_relaxed);
+            }
+            for (size_t v = 0; v < numVertices; ++v) {
+                vertexFacesBegin[v + 1] = vertexFacesBegin[v] + fill[v].load();
+                fill[v].store(vertexFacesBegin[v]);
+            }
+#pragma omp parallel for if (parallel)
+            for (OMPIndex i = 0; i < static_cast<OMPIndex>(numFaces); ++i) {
+                const TriangleIndices& t = faces[i];
+                vertexFaces[fill[t.v1].fetch_add(1, std::memory_order_relaxed)] = i * 4;
+                vertexFaces[fill[t.v2].fetch_add(1, std::memory_order_relaxed)] = i * 4 + 1;
+                vertexFaces[fill[t.v3].fetch_add(1, std::memory_order_relaxed)] = i * 4 + 2;
+            }
+        }
+
+        normals.resize(numVertices);
+        if (textureIndices.size())
+            texCoords.resize(numVertices);
+
+#pragma omp parallel for schedule(dynamic, 1024) if (parallel)
+        for (OMPIndex v = 0; v < static_cast<OMPIndex>(numVertices); ++v) {
+            const auto begin = vertexFaces.begin() + vertexFacesBegin[v];
+            const auto end = vertexFaces.begin() + vertexFacesBegin[v + 1];
+            std::sort(begin, end);
+
+            Normal3D normal{0.0f};
+            float weight = 0.0f;
+            for (auto it = begin; it != end; ++it) {
+                const uint32_t i = *it / 4;
+                const uint32_t corner = *it % 4;
+
+                if (!faceAttributes[i].isSmooth()) {
+                    // flat faces set the normal of their last vertex
+                    if (corner == 2)
+                        normal = faceShading[i].up;
                 }
                 else {
-                    normals.at(t.v1) += (up - normals.at(t.v1)) * u1;
-                    normals.at(t.v2) += (up - normals.at(t.v2)) * u2;
-                    normals.at(t.v3) += (up - normals.at(t.v3)) * u3;
+                    const float w = faceShading[i].weights[corner];
+
+                    // update factor for incremental mean
+                    float u = weight > 0.0f ? 1.0f : w;
+                    weight += w;
+                    u = w > 0.0f ? w / weight : u;
+
+                    if (i < normalIndices.size() && normalIndices[i]) {
+                        const TriangleIndices& tn = *normalIndices[i];
+                        const uint32_t n = corner == 0 ? tn.v1 : corner == 1 ? tn.v2 : tn.v3;
+                        normal += (objNormals[n] - normal) * u;
+                    }
+                    else {
+                        normal += (faceShading[i].up - normal) * u;
+                    }
+                }
+                if (i < textureIndices.size() && textureIndices[i]) {
+                    // vertices with different texture coordinates have been duplicated before
+                    const TriangleIndices& tt = *textureIndices[i];
+                    texCoords[v] = objTexCoords[corner == 0 ? tt.v1 : corner == 1 ? tt.v2 : tt.v3];
                 }
             }
-            if (i < textureIndices.size() && textureIndices.at(i)) {
-                const TriangleIndices& tt = *textureIndices.at(i);
-                // vertices with different texture coordinates have been duplicated before
-                texCoords.at(t.v1) = objTexCoords.at(tt.v1);
-                texCoords.at(t.v2) = objTexCoords.at(tt.v2);
-                texCoords.at(t.v3) = objTexCoords.at(tt.v3);
-            }
+            normals[v] = normal;
         }
-
-        invTotalArea = 1.0f / areaSum;
     }
 
     std::cout << "Loaded OBJ file: " << filename << " containing " << vertices.size()
@@ -303,6 +622,21 @@ void Mesh::loadOBJ(const std::string_view filename)
     bvh.construct(*this);
 }
 
+void Mesh::computeFaceAttributes(bool parallel)
+{
+    // the smooth groups are sorted, so each face can look up its group independently
+    faceAttributes.assign(faces.size(), {});
+#pragma omp parallel for if (parallel)
+    for (OMPIndex i = 0; i < static_cast<OMPIndex>(faces.size()); ++i) {
+        const auto group =
+            std::upper_bound(smoothGroups.cbegin(), smoothGroups.cend(), static_cast<size_t>(i),
+                             [](size_t face, const auto& range) { return face < range.second; });
+        if (group != smoothGroups.cend() && i >= group->first)
+            faceAttributes[i].smoothGroup =
+                static_cast<uint32_t>(std::distance(smoothGroups.cbegin(), group));
+    }
+}
+
 void Mesh::updateBounds()
 {
     aabb = {};
@@ -0,0 +1,137 @@
+#include <common/binary_file.h>
+#include <geometry/mesh.h>
+
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace {
+/// increase whenever the layout of the cached data changes
+constexpr uint32_t meshCacheVersion{4};
+
+std::string getCacheFilename(const std::string_view filename)
+{
+    return std::string{filename} + ".cache";
+}
+} // namespace
+
+struct Mesh::CacheHeader {
+    std::array<char, 8> magic{'G', 'D', 'V', 'M', 'E', 'S', 'H', '\0'};
+    uint32_t version{meshCacheVersion};
+    /// the layout of the wide BVH nodes depends on the instruction set
+    uint32_t wideNodeWidth{BVH::wideNodeWidth};
+    /// size and hash of the OBJ file the cache was created from
+    uint64_t sourceSize{0};
+    uint64_t sourceHash{0};
+
+    bool operator==(const CacheHeader&) const = default;
+};
+
+void Mesh::loadCached(const std::string_view filename)
+{
+    CacheHeader header;
+    {
+        const MappedFile source{std::string{filename}};
+        if (!source) {
+            // report the error as usual
+            loadOBJ(filename);
+            return;
+        }
+        header.sourceSize = source.data().size();
+        header.sourceHash = hashBytes(source.data());
+    }
+
+    if (readCache(filename, header))
+        return;
+
+    loadOBJ(filename);
+    writeCache(filename, header);
+}
+
+bool Mesh::readCache(const std::string_view filename, const CacheHeader& header)
+{
+    const MappedFile cache{getCacheFilename(filename)};
+    if (!cache)
+        return false;
+
+    clear();
+
+    BinaryReader in{cache.data()};
+    CacheHeader cachedHeader;
+    std::vector<char> sourceFilename;
+    std::vector<std::array<uint64_t, 2>> cachedSmoothGroups;
+    if (!in.read(cachedHeader) || cachedHeader != header || !in.read(sourceFilename)
+        || std::string_view{sourceFilename.data(), sourceFilename.size()} != filename)
+        return false;
+
+    bool valid = in.read(vertices) && in.read(faces) && in.read(aabb) && in.read(normals)
+              && in.read(texCoords) && in.read(faceAreas) && in.read(faceAreaPrefixSum)
+              && in.read(invTotalArea) && in.read(cachedSmoothGroups);
+
+    // check all references, so a corrupted file cannot cause out of bounds accesses
+    valid = valid && normals.size() == vertices.size()
+         && (texCoords.empty() || texCoords.size() == vertices.size())
+         && faceAreas.size() == faces.size() && faceAreaPrefixSum.size() == faces.size();
+    for (const TriangleIndices& face : faces)
+        valid = valid && face.v1 < vertices.size() && face.v2 < vertices.size()
+             && face.v3 < vertices.size();
+    for (auto [begin, end] : cachedSmoothGroups) {
+        valid = valid && begin <= end && end <= faces.size();
+        smoothGroups.emplace_back(begin, end);
+    }
+
+    valid = valid && bvh.read(in, faces.size()) && in.atEnd();
+    if (!valid) {
+        std::cerr << "ignoring invalid mesh cache " << getCacheFilename(filename) << std::endl;
+        clear();
+        return false;
+    }
+    computeFaceAttributes(true);
+
+    std::cout << "Loaded cached mesh: " << filename << " containing " << vertices.size()
+              << " vertices and " << faces.size() << " faces (" << bvh.getNodes().size()
+              << " BVH nodes)." << std::endl;
+    return true;
+}
+
+void Mesh::writeCache(const std::string_view filename, const CacheHeader& header) const
+{
+    const std::string cacheFilename = getCacheFilename(filename);
+    // write to a temporary file first, so other processes never read an incomplete cache
+    const std::string temporaryFilename = cacheFilename + ".tmp";
+    {
+        std::ofstream out{temporaryFilename, std::ios::binary};
+
+        std::vector<std::array<uint64_t, 2>> cachedSmoothGroups;
+        for (auto [begin, end] : smoothGroups)
+            cachedSmoothGroups.push_back({begin, end});
+
+        writeBinary(out, header);
+        writeBinary(out, std::vector<char>{filename.begin(), filename.end()});
+        writeBinary(out, vertices);
+        writeBinary(out, faces);
+        writeBinary(out, aabb);
+        writeBinary(out, normals);
+        writeBinary(out, texCoords);
+        writeBinary(out, faceAreas);
+        writeBinary(out, faceAreaPrefixSum);
+        writeBinary(out, invTotalArea);
+        writeBinary(out, cachedSmoothGroups);
+        bvh.write(out);
+
+        if (!out) {
+            std::cerr << "failed to write the mesh cache " << cacheFilename << std::endl;
+            out.close();
+            std::error_code error;
+            std::filesystem::remove(temporaryFilename, error);
+            return;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporaryFilename, cacheFilename, error);
+    if (error)
+        std::cerr << "failed to write the mesh cache " << cacheFilename << ": " << error.message()
+                  << std::endl;
+}
@@ -1,5 +1,6 @@
 #include <render/raytracer.h>
 
+#include <geometry/morton.h>
 #include <render/camera.h>
 #include <render/color.h>
 #include <render/film.h>
@@ -7,9 +8,81 @@
 #include <render/sampler.h>
 #include <render/scene.h>
 
-Color RayTracer::depthIntegrator(const Ray& cameraRay) const
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <vector>
+
+namespace {
+/// the paths of a batch that are still being traced (structure of arrays)
+struct PathQueue {
+    /// index of the camera ray that started the path
+    std::vector<uint32_t> pathIndex;
+    /// the next ray of the path
+    std::vector<Ray> rays;
+    /// attenuation of emitted radiance due to previous intersections (BRDF*cosine/PDF)
+    std::vector<Color> throughput;
+    /// whether direct light was sampled at the previous intersection
+    std::vector<uint8_t> rough;
+
+    size_t size() const { return rays.size(); }
+
+    void push(uint32_t path, const Ray& ray, const Color& pathThroughput, bool roughSurface)
+    {
+        pathIndex.push_back(path);
+        rays.push_back(ray);
+        throughput.push_back(pathThroughput);
+        rough.push_back(roughSurface);
+    }
+
+    /// append path i of the other queue
+    void push(const PathQueue& other, size_t i)
+    {
+        push(other.pathIndex[i], other.rays[i], other.throughput[i], other.rough[i]);
+    }
+
+    void clear()
+    {
+        pathIndex.clear();
+        rays.clear();
+        throughput.clear();
+        rough.clear();
+    }
+};
+
+/// 30 bit sort key of a ray: the octant of its direction, then the Morton code of its origin
+uint32_t raySortKey(const Ray& ray, const AABB& sceneBounds, const Vector3D& invSceneExtents)
+{
+    const uint32_t octant = (ray.direction.x < 0.0f ? 4U : 0U) | (ray.direction.y < 0.0f ? 2U : 0U)
+                          | (ray.direction.z < 0.0f ? 1U : 0U);
+    Vector3D relative = (ray.origin - sceneBounds.min) * invSceneExtents;
+    // flat scenes have no extent in some dimension
+    for (uint8_t dim = 0; dim < 3; ++dim) {
+        if (!std::isfinite(relative[dim]))
+            relative[dim] = 0.0f;
+    }
+    // (the finest level of the grid is dropped to make room for the octant)
+    return (octant << 27) | (mortonCode(relative) >> 3);
+}
+
+#ifdef TRAVERSAL_STATISTICS
+/// map [0, 1] to blue, cyan, green, yellow and red
+Color heatMap(float t)
+{
+    t = std::clamp(t, 0.0f, 1.0f) * 4.0f;
+    if (t < 1.0f)
+        return {0.0f, t, 1.0f};
+    if (t < 2.0f)
+        return {0.0f, 1.0f, 2.0f - t};
+    if (t < 3.0f)
+        return {t - 2.0f, 1.0f, 0.0f};
+    return {1.0f, 4.0f - t, 0.0f};
+}
+#endif
+} // namespace
+
+Color RayTracer::depthIntegrator(const Ray& cameraRay, const Intersection& its) const
 {
-    const Intersection its{scene, cameraRay};
     if (!its)
         return {};
 
@@ -18,18 +91,18 @@ Color RayTracer::depthIntegrator(const Ray& cameraRay) const
     return {its.distance / bounds.extents().maxComponent()};
 }
 
-Color RayTracer::positionIntegrator(const Ray& cameraRay) const
+Color RayTracer::positionIntegrator(const Ray& cameraRay, const Intersection& cameraHit) const
 {
-    const ShadingIntersection its{scene, cameraRay};
+    const ShadingIntersection its{scene, cameraHit};
     if (!its)
         return {};
 
     return Color{(its.point - scene.getBounds().min) / scene.getBounds().extents()};
 }
 
-Color RayTracer::normalIntegrator(const Ray& cameraRay) const
+Color RayTracer::normalIntegrator(const Ray& cameraRay, const Intersection& cameraHit) const
 {
-    const ShadingIntersection its{scene, cameraRay};
+    const ShadingIntersection its{scene, cameraHit};
     if (!its)
         return {};
 
@@ -41,7 +114,29 @@ Color RayTracer::whittedIntegrator(const Ray& cameraRay, uint32_t depth) const
     if (depth >= params.maxDepth)
         return {};
 
-    const ShadingIntersection its{scene, cameraRay};
+    return whittedIntegrator(cameraRay, {scene, cameraRay}, depth);
+}
+
+Color RayTracer::traversalCostIntegrator(const Ray& cameraRay) const
+{
+#ifdef TRAVERSAL_STATISTICS
+    // trace the ray on its own, packets of camera rays share their nodes
+    const Intersection its{scene, cameraRay};
+    const uint64_t cost = its.counters.nodesVisited + its.counters.triangleTests;
+
+    return heatMap(static_cast<float>(cost) / static_cast<float>(params.maxTraversalCost));
+#else
+    return {0.0f};
+#endif
+}
+
+Color RayTracer::whittedIntegrator(const Ray& cameraRay, const Intersection& cameraHit,
+                                   uint32_t depth) const
+{
+    if (depth >= params.maxDepth)
+        return {};
+
+    const ShadingIntersection its{scene, cameraHit};
     if (!its)
         return {};
 
@@ -73,11 +168,11 @@ Color RayTracer::whittedIntegrator(const Ray& cameraRay, uint32_t depth) const
     return result;
 }
 
-Color RayTracer::pathIntegrator(const Ray& cameraRay) const
+Color RayTracer::pathIntegrator(const Ray& cameraRay, const Intersection& cameraHit) const
 {
     Ray ray{cameraRay};
 
-    ShadingIntersection its{scene, ray};
+    ShadingIntersection its{scene, cameraHit};
     if (!its)
         return {};
 
@@ -139,6 +234,179 @@ Color RayTracer::pathIntegrator(const Ray& cameraRay) const
     return result;
 }
 
+void RayTracer::wavefrontPathIntegrator(std::span<const Ray> cameraRays,
+                                        std::span<const Intersection> cameraHits,
+                                        std::span<Color> colors) const
+{
+    /// sample area lights or just compute their contribution via brute-force path tracing
+    const bool sampleAreaLights = true;
+
+    // generate: one path per camera ray
+    PathQueue paths;
+    PathQueue nextPaths;
+    for (uint32_t k = 0; k < cameraRays.size(); ++k) {
+        colors[k] = {};
+        paths.push(k, cameraRays[k], 1.0f, false);
+    }
+    std::vector<Intersection> hits{cameraHits.begin(), cameraHits.end()};
+
+    // the paths that hit a front face, grouped by the kind of material
+    std::vector<uint32_t> shadedPaths;
+    std::vector<ShadingIntersection> shadedHits;
+    std::vector<Vector3D> shadedOmegaO;
+    std::vector<uint32_t> roughPaths;
+    std::vector<uint32_t> specularPaths;
+
+    // sort keys of the secondary rays in the upper and the index of their path in the lower bits
+    std::vector<uint64_t> sortKeys;
+    const AABB& sceneBounds = scene.getBounds();
+    const Vector3D invSceneExtents = sceneBounds.extents().inverse();
+
+    // the shadow rays of all rough surfaces and the radiance they carry if they are not occluded
+    std::vector<Ray> shadowRays;
+    std::vector<Color> shadowRadiance;
+    std::vector<uint32_t> shadowPaths;
+
+    for (uint32_t depth = 1; paths.size() > 0 && depth <= params.maxDepth; ++depth) {
+        // extend: find the next intersection of all paths (the camera rays were already traced)
+        if (depth > 1) {
+            // reorder the incoherent secondary rays, so that neighboring rays start close to each
+            // other and traverse the tree in a similar order
+            if (params.sortSecondaryRays) {
+                sortKeys.clear();
+                for (uint32_t k = 0; k < paths.size(); ++k) {
+                    const uint64_t key = raySortKey(paths.rays[k], sceneBounds, invSceneExtents);
+                    sortKeys.push_back((key << 32) | k);
+                }
+                std::sort(sortKeys.begin(), sortKeys.end());
+
+                nextPaths.clear();
+                for (const uint64_t key : sortKeys)
+                    nextPaths.push(paths, static_cast<uint32_t>(key));
+                std::swap(paths, nextPaths);
+            }
+
+            hits.resize(paths.size());
+            for (size_t k = 0; k < paths.size(); ++k)
+                hits[k] = {scene, paths.rays[k]};
+        }
+
+        // shade: terminate the paths that left the scene or hit a backface, add emitted radiance
+        shadedPaths.clear();
+        shadedHits.clear();
+        shadedOmegaO.clear();
+        roughPaths.clear();
+        specularPaths.clear();
+        for (uint32_t k = 0; k < paths.size(); ++k) {
+            if (!hits[k])
+                continue;
+
+            const ShadingIntersection its{scene, hits[k]};
+            const Material& material = scene.getInstances().at(its.instanceIndex).material;
+            const Vector3D omegaO = its.shadingFrame.toLocal(-paths.rays[k].direction);
+
+            // backfaces are black
+            if (omegaO.z < 0.0f && !material.isDielectric())
+                continue;
+
+            // (but only if we did not sample direct light at the previous intersection)
+            if ((!sampleAreaLights || !paths.rough[k]) && material.isEmitter())
+                colors[paths.pathIndex[k]] += paths.throughput[k] * material.emittedRadiance;
+
+            (material.isRough() ? roughPaths : specularPaths)
+                .push_back(static_cast<uint32_t>(shadedPaths.size()));
+            shadedPaths.push_back(k);
+            shadedHits.push_back(its);
+            shadedOmegaO.push_back(omegaO);
+        }
+
+        // the paths are not continued after the last bounce (and no direct light is sampled)
+        if (depth == params.maxDepth)
+            break;
+
+        nextPaths.clear();
+        shadowRays.clear();
+        shadowRadiance.clear();
+        shadowPaths.clear();
+
+        // rough surfaces: sample direct light and continue in a random direction
+        for (const uint32_t i : roughPaths) {
+            const uint32_t k = shadedPaths[i];
+            const ShadingIntersection& its = shadedHits[i];
+            const Material& material = scene.getInstances().at(its.instanceIndex).material;
+            const Vector3D& omegaO = shadedOmegaO[i];
+
+            for (const auto& light : scene.getLights()) {
+                if (!sampleAreaLights && !light.isPoint())
+                    continue;
+
+                const auto [Li, pos] = light.sampleLi(its.point);
+                const Ray shadowRay = Ray::shadowRay(its.point, pos);
+                const Vector3D omegaI = its.shadingFrame.toLocal(shadowRay.direction);
+                if (omegaI.z <= 0.0f)
+                    continue;
+
+                shadowRays.push_back(shadowRay);
+                shadowRadiance.push_back(paths.throughput[k] * Li * material.eval(omegaO, omegaI)
+                                         * omegaI.z);
+                shadowPaths.push_back(paths.pathIndex[k]);
+            }
+
+            const Vector3D omegaI = Sampler::uniformHemisphere();
+            const Color throughput = paths.throughput[k] * material.eval(omegaO, omegaI) * omegaI.z
+                                   * (1.0f / Sampler::uniformHemispherePdf());
+            if (!throughput.isBlack())
+                nextPaths.push(paths.pathIndex[k], {its.point, its.shadingFrame.toWorld(omegaI)},
+                               throughput, true);
+        }
+
+        // specular surfaces: the outgoing ray direction is fixed - we cannot sample it
+        for (const uint32_t i : specularPaths) {
+            const uint32_t k = shadedPaths[i];
+            const ShadingIntersection& its = shadedHits[i];
+            const Material& material = scene.getInstances().at(its.instanceIndex).material;
+            const auto [omegaI, fresnel] = specularReflection(material, shadedOmegaO[i]);
+            const Color throughput = paths.throughput[k] * fresnel;
+            if (!throughput.isBlack())
+                nextPaths.push(paths.pathIndex[k], {its.point, its.shadingFrame.toWorld(omegaI)},
+                               throughput, false);
+        }
+
+        // shadow rays: accumulate the direct light of all unoccluded shadow rays
+        for (size_t s = 0; s < shadowRays.size(); ++s) {
+            if (!Intersection::occluded(scene, shadowRays[s]))
+                colors[shadowPaths[s]] += shadowRadiance[s];
+        }
+
+        std::swap(paths, nextPaths);
+    }
+
+    // accumulate: like pathIntegrator, pixels covered by the scene are opaque
+    for (uint32_t k = 0; k < cameraRays.size(); ++k)
+        colors[k].a = cameraHits[k] ? 1.0f : 0.0f;
+}
+
+Color RayTracer::integrate(const Ray& cameraRay, const Intersection& cameraHit) const
+{
+    switch (params.mode) {
+    case RayTracerParameters::RenderMode::Depth:
+        return depthIntegrator(cameraRay, cameraHit);
+    case RayTracerParameters::RenderMode::Position:
+        return positionIntegrator(cameraRay, cameraHit);
+    case RayTracerParameters::RenderMode::Normal:
+        return normalIntegrator(cameraRay, cameraHit);
+    case RayTracerParameters::RenderMode::Whitted:
+        return whittedIntegrator(cameraRay, cameraHit);
+    case RayTracerParameters::RenderMode::Path:
+    // (single rays, e.g. of the preview passes, are traced by the equivalent megakernel)
+    case RayTracerParameters::RenderMode::Wavefront:
+        return pathIntegrator(cameraRay, cameraHit);
+    case RayTracerParameters::RenderMode::TraversalCost:
+        return traversalCostIntegrator(cameraRay);
+    }
+    return {};
+}
+
 Color RayTracer::computeDirectLight(const ShadingIntersection& its, const Vector3D omegaO,
                                     bool pointLightsOnly) const
 {
@@ -152,7 +420,7 @@ Color RayTracer::computeDirectLight(const ShadingIntersection& its, const Vector
         const auto [Li, pos] = light.sampleLi(its.point);
         const Ray shadowRay = Ray::shadowRay(its.point, pos);
         const Vector3D omegaI = its.shadingFrame.toLocal(shadowRay.direction);
-        if (omegaI.z <= 0.0f || Intersection{scene, shadowRay})
+        if (omegaI.z <= 0.0f || Intersection::occluded(scene, shadowRay))
             continue;
 
         result += Li * material.eval(omegaO, omegaI) * omegaI.z;
@@ -192,6 +460,7 @@ void RayTracer::setScene(Scene&& scene)
     stop();
 
     this->scene = std::move(scene);
+    this->scene.buildInstanceBVH();
 }
 
 bool RayTracer::setParams(const RayTracerParameters params, const CameraParameters& cameraParams)
@@ -276,6 +545,8 @@ void RayTracer::render()
     uint32_t blockResDivider = 1;
     sppRendered = 0;
     partialSPPRendered = 0.0f;
+    // drop the work of interrupted renders
+    collectThreadCounters();
 
     while (keep_rendering && sppRendered < params.maxSPP) {
         const Point2D sub_pixel{radicalInverse(2, sppRendered), radicalInverse(3, sppRendered)};
@@ -298,6 +569,109 @@ void RayTracer::render()
             using OMPIndex = uint32_t;
 #endif
 
+            constexpr uint32_t tileSize = 4;
+
+            // the wavefront integrator traces all paths of a block at full resolution as one batch
+            if (pixelSize == 1 && index == 0
+                && params.mode == RayTracerParameters::RenderMode::Wavefront) {
+                const uint32_t numBlocksTotal = numBlocks.x * numBlocks.y;
+
+#pragma omp parallel for schedule(dynamic)
+                for (OMPIndex block = 0; block < numBlocksTotal; ++block) {
+                    if (!keep_rendering)
+                        continue;
+
+                    const Pixel blockOrigin{block % numBlocks.x * blockSize,
+                                            block / numBlocks.x * blockSize};
+                    std::vector<Pixel> pixels;
+                    std::vector<Ray> rays;
+                    std::vector<Intersection> intersections;
+                    pixels.reserve(blockSize * blockSize);
+                    rays.reserve(blockSize * blockSize);
+                    intersections.reserve(blockSize * blockSize);
+
+                    // the camera rays of each tile are still traced together
+                    for (uint32_t tileY = 0; tileY < blockSize; tileY += tileSize) {
+                        for (uint32_t tileX = 0; tileX < blockSize; tileX += tileSize) {
+                            const Pixel tile{blockOrigin.x + tileX, blockOrigin.y + tileY};
+                            const size_t tileBegin = rays.size();
+                            for (uint32_t y = tile.y; y < std::min(tile.y + tileSize, resolution.y);
+                                 ++y) {
+                                for (uint32_t x = tile.x;
+                                     x < std::min(tile.x + tileSize, resolution.x); ++x) {
+                                    const Point2D normalizedScreenCoords =
+                                        ((Point2D{Pixel{x, y}} + sub_pixel) * invResolution - 0.5f)
+                                        * 2.0f;
+                                    pixels.push_back({x, y});
+                                    rays.push_back(camera.generateRay(normalizedScreenCoords));
+                                }
+                            }
+                            intersections.resize(rays.size());
+                            Intersection::intersect(
+                                scene, std::span{rays}.subspan(tileBegin),
+                                std::span{intersections}.subspan(tileBegin));
+                        }
+                    }
+
+                    std::vector<Color> colors(rays.size());
+                    wavefrontPathIntegrator(rays, intersections, colors);
+                    for (size_t k = 0; k < rays.size(); ++k)
+                        film.addPixelColor(pixels[k], colors[k]);
+
+                    new_sample_available.store(true, std::memory_order_relaxed);
+                    partialSPPRendered += invNumBlock;
+                }
+                index = nextResIndex;
+                new_sample_available.store(true, std::memory_order_relaxed);
+                continue;
+            }
+
+            // every sample after the first one renders all pixels at full resolution, so the
+            // coherent camera rays of small tiles can be traced together
+            if (pixelSize == 1 && index == 0) {
+                constexpr uint32_t numTilesPerBlock = (blockSize / tileSize) * (blockSize / tileSize);
+                const uint32_t numTiles = numBlocks.x * numBlocks.y * numTilesPerBlock;
+
+#pragma omp parallel for schedule(dynamic)
+                for (OMPIndex i = 0; i < numTiles; ++i) {
+                    if (!keep_rendering)
+                        continue;
+
+                    if (i % numTilesPerBlock == 0) {
+                        new_sample_available.store(true, std::memory_order_relaxed);
+                        partialSPPRendered += invNumBlock;
+                    }
+
+                    const uint32_t block = i % (numBlocks.x * numBlocks.y);
+                    const uint32_t inBlockTile = i / (numBlocks.x * numBlocks.y);
+                    const Pixel blockTile = blockPos(blockSize / tileSize, inBlockTile);
+                    const Pixel tile{block % numBlocks.x * blockSize + blockTile.x * tileSize,
+                                     block / numBlocks.x * blockSize + blockTile.y * tileSize};
+
+                    std::array<Pixel, tileSize * tileSize> pixels;
+                    std::array<Ray, tileSize * tileSize> rays;
+                    uint32_t numRays = 0;
+                    for (uint32_t y = tile.y; y < std::min(tile.y + tileSize, resolution.y); ++y) {
+                        for (uint32_t x = tile.x; x < std::min(tile.x + tileSize, resolution.x);
+                             ++x) {
+                            const Point2D normalizedScreenCoords =
+                                ((Point2D{Pixel{x, y}} + sub_pixel) * invResolution - 0.5f) * 2.0f;
+                            pixels[numRays] = {x, y};
+                            rays[numRays++] = camera.generateRay(normalizedScreenCoords);
+                        }
+                    }
+
+                    std::array<Intersection, tileSize * tileSize> intersections;
+                    Intersection::intersect(scene, {rays.data(), numRays},
+                                            {intersections.data(), numRays});
+                    for (uint32_t k = 0; k < numRays; ++k)
+                        film.addPixelColor(pixels[k], integrate(rays[k], intersections[k]));
+                }
+                index = nextResIndex;
+                new_sample_available.store(true, std::memory_order_relaxed);
+                continue;
+            }
+
 #pragma omp parallel for schedule(dynamic)
             for (OMPIndex i = index; i < nextResIndex; ++i) {
                 if (!keep_rendering)
@@ -320,25 +694,7 @@ void RayTracer::render()
                 const Point2D normalizedScreenCoords =
                     ((Point2D{pixel} + sub_pixel) * invResolution - 0.5f) * 2.0f;
                 const Ray ray = camera.generateRay(normalizedScreenCoords);
-
-                Color color;
-                switch (params.mode) {
-                case RayTracerParameters::RenderMode::Depth:
-                    color = depthIntegrator(ray);
-                    break;
-                case RayTracerParameters::RenderMode::Position:
-                    color = positionIntegrator(ray);
-                    break;
-                case RayTracerParameters::RenderMode::Normal:
-                    color = normalIntegrator(ray);
-                    break;
-                case RayTracerParameters::RenderMode::Whitted:
-                    color = whittedIntegrator(ray);
-                    break;
-                case RayTracerParameters::RenderMode::Path:
-                    color = pathIntegrator(ray);
-                    break;
-                }
+                const Color color = integrate(ray, {scene, ray});
 
                 if (sppRendered)
                     film.addPixelColor(pixel, color);
@@ -348,7 +704,29 @@ void RayTracer::render()
             index = nextResIndex;
             new_sample_available.store(true, std::memory_order_relaxed);
         }
+        const TraversalCounters counters = collectThreadCounters();
+        {
+            std::lock_guard lock{frameCountersMutex};
+            frameCounters = counters;
+        }
         ++sppRendered;
         partialSPPRendered = 0.0f;
     }
 }
+
+TraversalCounters RayTracer::collectThreadCounters()
+{
+    TraversalCounters counters;
+#ifdef TRAVERSAL_STATISTICS
+    // the render loops run on the threads of the same team
+#pragma omp parallel
+    {
+#pragma omp critical
+        {
+            counters += TraversalCounters::thisThread();
+            TraversalCounters::thisThread() = {};
+        }
+    }
+#endif
+    return counters;
+}
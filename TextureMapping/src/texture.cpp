@@ -1,47 +1,77 @@
 #include <render/texture.h>
 
+#include <common/thread_pool.h>
+
 #include <iostream>
 #include <stb_image.h>
 #include <stdexcept>
 #include <string>
+#include <utility>
 
 using namespace std::string_literals;
 
-const Texture& detail::TextureRegistry::loadTexture(std::string_view filename)
+namespace {
+Texture readImageFile(const std::string& filename)
 {
-    TextureRegistry& instance = getInstance();
-    if (!instance.textures.contains(filename.data())) {
-        int x, y, imageChannels;
-        stbi_uc* dataPtr = stbi_load(filename.data(), &x, &y, &imageChannels, 0);
-        if (!dataPtr)
-            throw std::runtime_error("failed to read image file "s + std::string(filename));
-
-        const Texture texture{{static_cast<uint32_t>(x), static_cast<uint32_t>(y)},
-                              Texture::Channels{imageChannels},
-                              Texture::DataType{Texture::DataType::UInt8}};
-
-        const size_t rowSize = texture.dataSize() / texture.resolution.y;
-        // flip the texture vertically
-        for (uint32_t i = 0; i < texture.resolution.y; ++i) {
-            std::copy_n(reinterpret_cast<std::byte*>(dataPtr)
-                            + rowSize * (texture.resolution.y - i - 1),
-                        rowSize, texture.data + rowSize * i);
-        }
-
-        instance.textures.emplace(filename, texture);
-
-        std::cout << "Loaded image file: " << filename << " with " << x << "x" << y
-                  << " pixels and " << imageChannels << " channel(s)." << std::endl;
+    int x, y, imageChannels;
+    stbi_uc* dataPtr = stbi_load(filename.c_str(), &x, &y, &imageChannels, 0);
+    if (!dataPtr)
+        throw std::runtime_error("failed to read image file "s + filename);
+
+    const Texture texture{{static_cast<uint32_t>(x), static_cast<uint32_t>(y)},
+                          Texture::Channels{imageChannels},
+                          Texture::DataType{Texture::DataType::UInt8}};
+
+    const size_t rowSize = texture.dataSize() / texture.resolution.y;
+    // flip the texture vertically
+    for (uint32_t i = 0; i < texture.resolution.y; ++i) {
+        std::copy_n(reinterpret_cast<std::byte*>(dataPtr)
+                        + rowSize * (texture.resolution.y - i - 1),
+                    rowSize, texture.data + rowSize * i);
     }
+    stbi_image_free(dataPtr);
 
-    return instance.textures.at(filename.data());
+    std::cout << "Loaded image file: "s + filename + " with " + std::to_string(x) + "x"
+                     + std::to_string(y) + " pixels and " + std::to_string(imageChannels)
+                     + " channel(s).\n"
+              << std::flush;
+    return texture;
+}
+} // namespace
+
+std::shared_future<Texture> detail::TextureRegistry::loadTextureAsync(std::string_view filename)
+{
+    TextureRegistry& instance = getInstance();
+    std::lock_guard lock{instance.mutex};
+    auto it = instance.textures.find(filename);
+    if (it == instance.textures.end()) {
+        auto load = [filename = std::string{filename}] {
+            try {
+                return readImageFile(filename);
+            }
+            catch (...) {
+                // forget the failed load, so that the file can be requested again (the current
+                // requests still receive the error)
+                TextureRegistry& registry = getInstance();
+                std::lock_guard lock{registry.mutex};
+                registry.textures.erase(filename);
+                throw;
+            }
+        };
+        it = instance.textures
+                 .emplace(filename, ThreadPool::getAssetLoaders().submit(std::move(load)))
+                 .first;
+    }
+    return it->second;
 }
 
 void detail::TextureRegistry::allocateData(Texture& texture)
 {
     std::unique_ptr<std::byte[]> buffer = std::make_unique<std::byte[]>(texture.dataSize());
     texture.data = buffer.get();
-    getInstance().textureData.emplace_back(std::move(buffer));
+    TextureRegistry& instance = getInstance();
+    std::lock_guard lock{instance.mutex};
+    instance.textureData.emplace_back(std::move(buffer));
 }
 
 Texture::Texture(Resolution resolution, Channels channels, DataType dataType, std::byte* data)
@@ -55,3 +85,8 @@ Texture::Texture(std::string_view filename)
     : Texture{detail::TextureRegistry::loadTexture(filename)}
 {
 }
+
+void Texture::prefetch(std::string_view filename)
+{
+    detail::TextureRegistry::loadTextureAsync(filename);
+}
@@ -0,0 +1,114 @@
+#include <geometry/mesh.h>
+#include <render/instance.h>
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace {
+int numFailures = 0;
+
+void check(bool condition, std::string_view what)
+{
+    if (!condition) {
+        std::printf("FAILED: %.*s\n", static_cast<int>(what.size()), what.data());
+        ++numFailures;
+    }
+}
+
+/// write the OBJ text to a temporary file and return its name
+std::string writeOBJ(std::string_view name, std::string_view contents)
+{
+    const std::filesystem::path path = std::filesystem::temp_directory_path() / name;
+    std::ofstream{path, std::ios::binary} << contents;
+    return path.string();
+}
+
+/// returns true if loading the file throws the parse error (serial and parallel)
+bool failsToParse(const std::string& filename)
+{
+    for (const bool parallel : {false, true}) {
+        try {
+            Mesh mesh;
+            mesh.loadOBJ(filename, parallel);
+            return false;
+        }
+        catch (const std::runtime_error& e) {
+            if (!std::string_view{e.what()}.starts_with("failed to parse the OBJ file"))
+                return false;
+        }
+    }
+    return true;
+}
+
+constexpr std::string_view vertices{"v 0 0 0\nv 1 0 0\nv 0 1 0\nvt 0 0\nvn 0 0 1\n"};
+} // namespace
+
+int main()
+{
+    {
+        Mesh mesh;
+        mesh.loadOBJ(writeOBJ("mesh_test_valid.obj",
+                              std::string{vertices} + "f 1/1/1 2/1/1 -1/-1/-1\n"));
+        check(mesh.getFaces().size() == 1 && mesh.getVertices().size() == 3, "valid face");
+    }
+
+    {
+        Mesh mesh;
+        mesh.loadOBJ(writeOBJ("mesh_test_smooth.obj",
+                              std::string{vertices}
+                                  + "s off\nf 1 2 3\ns 1\nf 1 2 3\ns off\nf 1 2 3\n"));
+        check(!mesh.isSmoothFace(0) && mesh.isSmoothFace(1) && !mesh.isSmoothFace(2),
+              "smooth faces");
+
+        // faces added afterwards are flat once the BVH was refitted
+        mesh.getFaces().push_back({0, 1, 2});
+        mesh.refitBVH();
+        check(mesh.getFaceAttributes().size() == 4 && !mesh.isSmoothFace(3)
+                  && mesh.isSmoothFace(1),
+              "face attributes after adding a face");
+    }
+
+    check(failsToParse(writeOBJ("mesh_test_zero.obj", std::string{vertices} + "f 0 1 2\n")),
+          "vertex index 0");
+    check(failsToParse(writeOBJ("mesh_test_past.obj", std::string{vertices} + "f 1 2 4\n")),
+          "vertex index past the last vertex");
+    check(failsToParse(writeOBJ("mesh_test_relative.obj",
+                                std::string{vertices} + "f -1 -2 -4\n")),
+          "relative vertex index before the first vertex");
+    check(failsToParse(writeOBJ("mesh_test_texcoord.obj",
+                                std::string{vertices} + "f 1/2 2/1 3/1\n")),
+          "texture coordinate index past the last texture coordinate");
+    check(failsToParse(writeOBJ("mesh_test_normal.obj",
+                                std::string{vertices} + "f 1//1 2//1 3//2\n")),
+          "normal index past the last normal");
+    check(failsToParse(writeOBJ("mesh_test_huge.obj",
+                                std::string{vertices} + "f 1 2 4294967299\n")),
+          "vertex index beyond 32 bits");
+
+    {
+        // a failed load is not cached, so the file can be loaded once it exists
+        const std::filesystem::path path =
+            std::filesystem::temp_directory_path() / "mesh_test_late.obj";
+        std::filesystem::remove(path);
+        std::filesystem::remove(path.string() + ".cache");
+        bool failed = false;
+        try {
+            detail::MeshRegistry::loadMesh(path.string());
+        }
+        catch (const std::runtime_error&) {
+            failed = true;
+        }
+        writeOBJ("mesh_test_late.obj", std::string{vertices} + "f 1 2 3\n");
+        const Mesh* mesh = detail::MeshRegistry::loadMesh(path.string());
+        check(failed && mesh->getFaces().size() == 1, "loading a mesh again after it failed");
+    }
+
+    if (numFailures)
+        return 1;
+    std::printf("all mesh tests passed\n");
+    return 0;
+}